@@ -1,12 +1,25 @@
 #!/bin/bash
 
-# Directory containing your text frames
-FRAME_DIR="output"
+# Directory containing your text frames (batch jobs write to output/<video>)
+FRAME_DIR="${1:-output}"
 
+# Delta-compressed recordings (--delta) are decoded by the engine itself
+if [[ "$FRAME_DIR" == *.adelta ]]; then
+    exec ./bin/processor --play="$FRAME_DIR" "${@:2}"
+fi
 
-# Display each frame in sequence
+
+# Frames are shown at the rate the engine recorded (see --fps), 25 fps if none
+DELAY=0.04
+if [[ -f "$FRAME_DIR/.fps" ]]; then
+    DELAY=$(awk '$1 > 0 { printf "%.4f", 1 / $1 }' "$FRAME_DIR/.fps")
+    DELAY=${DELAY:-0.04}
+fi
+
+# Display each frame in sequence (none if the run used --live)
+shopt -s nullglob
 for frame in "$FRAME_DIR"/*.txt; do
     clear
     cat "$frame"
-    sleep 0.04
+    sleep "$DELAY"
 done
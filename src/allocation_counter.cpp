@@ -0,0 +1,26 @@
+// Replaces the global operator new to count heap allocations per thread (see
+// AllocationStats in buffer_pool.hpp). Linked into the engines only, so the
+// replacement is defined exactly once per program.
+
+#include <cstdlib>
+#include <new>
+
+thread_local size_t thread_heap_allocations = 0;
+
+void *operator new(size_t size)
+{
+    ++thread_heap_allocations;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,394 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using Payload = std::shared_ptr<const std::string>;
+
+// Clears the screen and draws the whole grid; what a viewer needs to (re)sync.
+inline std::string encode_full_frame(const std::vector<std::string> &grid)
+{
+    std::string out = "\x1b[2J\x1b[H";
+    for (size_t j = 0; j < grid.size(); ++j)
+    {
+        out += grid[j];
+        if (j + 1 < grid.size())
+            out += "\r\n";
+    }
+    return out;
+}
+
+// Redraws only the runs of cells that changed since `previous`. Runs separated by
+// a few unchanged cells are merged, since a cursor move costs more than the cells.
+inline std::string encode_delta_frame(const std::vector<std::string> &previous, const std::vector<std::string> &grid)
+{
+    if (previous.size() != grid.size())
+        return encode_full_frame(grid);
+
+    const size_t merge_gap = 6;
+    std::string out;
+    for (size_t j = 0; j < grid.size(); ++j)
+    {
+        const std::string &before = previous[j];
+        const std::string &row = grid[j];
+        if (before.size() != row.size())
+            return encode_full_frame(grid);
+
+        size_t i = 0;
+        while (i < row.size())
+        {
+            if (before[i] == row[i])
+            {
+                ++i;
+                continue;
+            }
+
+            size_t run_end = i + 1;
+            size_t last_changed = i;
+            while (run_end < row.size() && run_end - last_changed <= merge_gap)
+            {
+                if (before[run_end] != row[run_end])
+                    last_changed = run_end;
+                ++run_end;
+            }
+
+            out += "\x1b[" + std::to_string(j + 1) + ";" + std::to_string(i + 1) + "H";
+            out.append(row, i, last_changed - i + 1);
+            i = last_changed + 1;
+        }
+    }
+    return out;
+}
+
+// Fans pre-encoded frames out to any number of viewers over TCP or a Unix socket.
+// Everything runs on the caller's thread: publish() queues a frame for every
+// client, poll() accepts viewers and drains sockets that became writable.
+class BroadcastServer
+{
+public:
+    // `endpoint` is "PORT", "HOST:PORT" or "unix:/path/to/socket".
+    explicit BroadcastServer(const std::string &endpoint, size_t max_pending_bytes = 1 << 20);
+    ~BroadcastServer();
+
+    bool ok() const { return listen_fd >= 0 && epoll_fd >= 0; }
+    size_t client_count() const { return clients.size(); }
+
+    // A client whose queue would exceed the pending limit, or who just joined,
+    // drops what it has queued and gets `full` instead of `delta`.
+    void publish(const Payload &full, const Payload &delta);
+    void poll(int timeout_ms);
+
+private:
+    struct Client
+    {
+        std::deque<Payload> queue;
+        size_t offset = 0;
+        size_t pending = 0;
+        bool needs_keyframe = true;
+        bool waiting_writable = false;
+        bool read_closed = false;
+    };
+
+    void accept_clients();
+    void set_accepting(bool accepting);
+    void update_interest(int fd, Client &client);
+    void flush(int fd, Client &client);
+    void close_client(int fd);
+
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    size_t max_pending;
+    bool accepting = true;
+    std::chrono::steady_clock::time_point accept_paused_at;
+    std::string unix_path;
+    std::unordered_map<int, Client> clients;
+    std::vector<epoll_event> events;
+};
+
+inline BroadcastServer::BroadcastServer(const std::string &endpoint, size_t max_pending_bytes)
+    : max_pending(max_pending_bytes), events(256)
+{
+    // Every viewer holds a descriptor; the default soft limit (often 1024) is
+    // far below what the hard limit allows.
+    rlimit files{};
+    if (::getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max)
+    {
+        files.rlim_cur = files.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    if (endpoint.rfind("unix:", 0) == 0)
+    {
+        unix_path = endpoint.substr(5);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (unix_path.size() >= sizeof(addr.sun_path))
+        {
+            std::cerr << "Socket path too long: " << unix_path << std::endl;
+            return;
+        }
+        std::strncpy(addr.sun_path, unix_path.c_str(), sizeof(addr.sun_path) - 1);
+        ::unlink(unix_path.c_str());
+
+        listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd >= 0 && ::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+        {
+            std::cerr << "Failed to bind " << unix_path << ": " << std::strerror(errno) << std::endl;
+            ::close(listen_fd);
+            listen_fd = -1;
+        }
+    }
+    else
+    {
+        std::string host = "0.0.0.0";
+        std::string port = endpoint;
+        size_t colon = endpoint.rfind(':');
+        if (colon != std::string::npos)
+        {
+            host = endpoint.substr(0, colon);
+            port = endpoint.substr(colon + 1);
+        }
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(std::atoi(port.c_str())));
+        if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+        {
+            std::cerr << "Invalid listen address: " << host << std::endl;
+            return;
+        }
+
+        listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int reuse = 1;
+        if (listen_fd >= 0)
+            ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (listen_fd >= 0 && ::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+        {
+            std::cerr << "Failed to bind " << endpoint << ": " << std::strerror(errno) << std::endl;
+            ::close(listen_fd);
+            listen_fd = -1;
+        }
+    }
+
+    if (listen_fd < 0 || ::listen(listen_fd, SOMAXCONN) != 0)
+    {
+        std::cerr << "Unable to listen on " << endpoint << std::endl;
+        return;
+    }
+
+    epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+}
+
+inline BroadcastServer::~BroadcastServer()
+{
+    for (const auto &[fd, client] : clients)
+        ::close(fd);
+    if (epoll_fd >= 0)
+        ::close(epoll_fd);
+    if (listen_fd >= 0)
+        ::close(listen_fd);
+    if (!unix_path.empty())
+        ::unlink(unix_path.c_str());
+}
+
+inline void BroadcastServer::publish(const Payload &full, const Payload &delta)
+{
+    std::vector<int> fds;
+    fds.reserve(clients.size());
+    for (auto &[fd, client] : clients)
+    {
+        if (!client.needs_keyframe && client.pending + delta->size() > max_pending)
+            client.needs_keyframe = true;
+
+        if (client.needs_keyframe)
+        {
+            // Keep a half-sent payload so the viewer's stream stays well formed.
+            while (client.queue.size() > (client.offset > 0 ? 1u : 0u))
+            {
+                client.pending -= client.queue.back()->size();
+                client.queue.pop_back();
+            }
+            client.queue.push_back(full);
+            client.pending += full->size();
+            client.needs_keyframe = false;
+        }
+        else if (!delta->empty())
+        {
+            client.queue.push_back(delta);
+            client.pending += delta->size();
+        }
+
+        if (!client.waiting_writable)
+            fds.push_back(fd);
+    }
+
+    for (int fd : fds)
+    {
+        auto it = clients.find(fd);
+        if (it != clients.end())
+            flush(fd, it->second);
+    }
+}
+
+inline void BroadcastServer::poll(int timeout_ms)
+{
+    // Descriptors may also have been freed outside the server; try again now and then.
+    if (!accepting && std::chrono::steady_clock::now() - accept_paused_at > std::chrono::seconds(1))
+        set_accepting(true);
+
+    int n = ::epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), std::max(timeout_ms, 0));
+    for (int k = 0; k < n; ++k)
+    {
+        int fd = events[k].data.fd;
+        if (fd == listen_fd)
+        {
+            accept_clients();
+            continue;
+        }
+
+        auto it = clients.find(fd);
+        if (it == clients.end())
+            continue;
+
+        if (events[k].events & (EPOLLHUP | EPOLLERR))
+        {
+            close_client(fd);
+            continue;
+        }
+
+        if (events[k].events & EPOLLIN)
+        {
+            // Viewers have nothing to say; drain telnet negotiation and detect hangups.
+            // A viewer that only shut down its sending side is kept; it may still read.
+            char discard[512];
+            ssize_t r = ::recv(fd, discard, sizeof(discard), 0);
+            if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                close_client(fd);
+                continue;
+            }
+            if (r == 0)
+            {
+                it->second.read_closed = true;
+                update_interest(fd, it->second);
+            }
+        }
+
+        if (events[k].events & EPOLLOUT)
+            flush(fd, it->second);
+    }
+    if (n == static_cast<int>(events.size()))
+        events.resize(events.size() * 2);
+}
+
+inline void BroadcastServer::accept_clients()
+{
+    for (;;)
+    {
+        int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                // The pending connection stays queued and the listening socket
+                // stays readable, so stop watching it until a descriptor is freed.
+                std::cerr << "accept failed: " << std::strerror(errno) << "; pausing new viewers" << std::endl;
+                set_accepting(false);
+            }
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+            return;
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        clients[fd] = Client{};
+    }
+}
+
+inline void BroadcastServer::flush(int fd, Client &client)
+{
+    while (!client.queue.empty())
+    {
+        const std::string &payload = *client.queue.front();
+        ssize_t sent = ::send(fd, payload.data() + client.offset, payload.size() - client.offset, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                close_client(fd);
+                return;
+            }
+            break;
+        }
+
+        client.offset += static_cast<size_t>(sent);
+        client.pending -= static_cast<size_t>(sent);
+        if (client.offset == payload.size())
+        {
+            client.queue.pop_front();
+            client.offset = 0;
+        }
+    }
+
+    if (client.queue.empty() == client.waiting_writable)
+    {
+        client.waiting_writable = !client.queue.empty();
+        update_interest(fd, client);
+    }
+}
+
+inline void BroadcastServer::set_accepting(bool accept)
+{
+    if (accepting == accept)
+        return;
+    accepting = accept;
+    if (!accept)
+        accept_paused_at = std::chrono::steady_clock::now();
+    epoll_event ev{};
+    ev.events = accept ? uint32_t(EPOLLIN) : 0u;
+    ev.data.fd = listen_fd;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_fd, &ev);
+}
+
+inline void BroadcastServer::update_interest(int fd, Client &client)
+{
+    epoll_event ev{};
+    ev.events = (client.read_closed ? 0u : uint32_t(EPOLLIN)) | (client.waiting_writable ? uint32_t(EPOLLOUT) : 0u);
+    ev.data.fd = fd;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+inline void BroadcastServer::close_client(int fd)
+{
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    clients.erase(fd);
+    set_accepting(true);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+// Reusable buffers for the conversion hot loop, plus a heap allocation counter
+// to check that the steady state really does not allocate.
+//
+// The counter only sees operator new: buffers OpenCV allocates itself
+// (cv::Mat data, through cv::fastMalloc) are not counted. It is defined in
+// allocation_counter.cpp, which every program including this header must
+// link.
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// Allocations made through operator new by the current thread.
+extern thread_local size_t thread_heap_allocations;
+inline thread_local bool thread_warmed_up = false;
+
+// Adds up what workers allocate while converting, skipping each worker's first
+// frame, which is when its scratch buffers grow to size.
+class AllocationStats
+{
+public:
+    class Scope
+    {
+    public:
+        explicit Scope(AllocationStats &stats) : stats(stats), warm(thread_warmed_up), start(thread_heap_allocations) {}
+        ~Scope()
+        {
+            if (warm)
+                stats.steady.fetch_add(thread_heap_allocations - start, std::memory_order_relaxed);
+            stats.frames.fetch_add(1, std::memory_order_relaxed);
+            thread_warmed_up = true;
+        }
+
+    private:
+        AllocationStats &stats;
+        bool warm;
+        size_t start;
+    };
+
+    size_t steady_state_allocations() const { return steady.load(); }
+    size_t frames_measured() const { return frames.load(); }
+
+private:
+    std::atomic<size_t> steady{0};
+    std::atomic<size_t> frames{0};
+};
+
+// Frame-sized Mats handed from the decoder to the workers and back. Decoding
+// straight into a recycled buffer replaces a clone() per frame, and since
+// acquire() blocks once `capacity` buffers are out, it also bounds how far
+// decoding can run ahead of conversion.
+class FramePool
+{
+public:
+    explicit FramePool(size_t capacity) : capacity(capacity)
+    {
+        free_buffers.reserve(capacity);
+    }
+
+    cv::Mat acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this]
+                       { return !free_buffers.empty() || created < capacity; });
+        if (free_buffers.empty())
+        {
+            ++created;
+            return cv::Mat();
+        }
+        cv::Mat buffer = free_buffers.back();
+        free_buffers.pop_back();
+        return buffer;
+    }
+
+    // Notifies under the lock, so the pool may be destroyed as soon as the
+    // last buffer is back.
+    void release(cv::Mat buffer)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        free_buffers.push_back(buffer);
+        available.notify_one();
+    }
+
+    size_t buffers_created() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return created;
+    }
+
+private:
+    size_t capacity;
+    size_t created = 0;
+    std::vector<cv::Mat> free_buffers;
+    mutable std::mutex mutex;
+    std::condition_variable available;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Positional arguments keep their original meaning (font, font size, video).
+// Anything starting with "--" is an option, written as "--name" or "--name=value".
+struct CliArgs
+{
+    std::vector<std::string> positional;
+    std::map<std::string, std::string> options;
+
+    bool has(const std::string &name) const
+    {
+        return options.count(name) > 0;
+    }
+
+    std::string get(const std::string &name, const std::string &fallback = "") const
+    {
+        auto it = options.find(name);
+        return it == options.end() ? fallback : it->second;
+    }
+};
+
+inline CliArgs parse_cli(int argc, char *argv[])
+{
+    CliArgs args;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0)
+        {
+            args.positional.push_back(arg);
+            continue;
+        }
+
+        size_t eq = arg.find('=');
+        if (eq == std::string::npos)
+            args.options[arg.substr(2)] = "";
+        else
+            args.options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+    return args;
+}
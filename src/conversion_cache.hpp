@@ -0,0 +1,162 @@
+#pragma once
+
+// Content-addressed store of finished conversions. An entry is a delta store
+// (see delta_store.hpp) named after a digest of its key, a description of
+// everything that affects the result, so replaying the same clip with the same
+// font and grid needs neither decoding nor matching. Inputs and the key are
+// identified by SHA-256; the full key is also kept next to the entry and
+// compared on lookup. Entries are evicted least recently used first, using the
+// file modification time, which is refreshed on every hit.
+
+#include "sha256.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class ContentDigest
+{
+public:
+    void update(const void *data, size_t size)
+    {
+        sha.update(data, size);
+    }
+
+    void update(const std::string &text)
+    {
+        update(text.data(), text.size());
+        update("\0", 1);
+    }
+
+    bool update_file(const std::filesystem::path &path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+        std::vector<char> buffer(1 << 20);
+        while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0)
+            update(buffer.data(), static_cast<size_t>(in.gcount()));
+        return true;
+    }
+
+    std::string hex() const
+    {
+        return sha.hex();
+    }
+
+private:
+    Sha256 sha;
+};
+
+class ConversionCache
+{
+public:
+    ConversionCache(const std::string &dir, uintmax_t max_bytes) : dir(dir), max_bytes(max_bytes)
+    {
+        std::filesystem::create_directories(dir);
+    }
+
+    std::string entry_path(const std::string &key) const
+    {
+        ContentDigest name;
+        name.update(key);
+        return dir + "/" + name.hex() + ".adelta";
+    }
+
+    // True if the entry exists and was stored under this exact key; marks it as
+    // most recently used.
+    bool lookup(const std::string &key) const
+    {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        const std::string path = entry_path(key);
+        if (!fs::exists(path, ec) || !fs::exists(path + ".idx", ec))
+            return false;
+
+        std::ifstream stored_key(path + ".key", std::ios::binary);
+        std::string stored((std::istreambuf_iterator<char>(stored_key)), std::istreambuf_iterator<char>());
+        if (stored != key)
+            return false;
+        fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+        return true;
+    }
+
+    // Copies a finished delta store (and its index) into the cache, then evicts
+    // old entries until the cache fits its size cap again.
+    bool insert(const std::string &key, const std::string &store_path) const
+    {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        const std::string path = entry_path(key);
+
+        // Copy under temporary names and rename, so readers never see half an
+        // entry. The key goes last: until it is in place the entry is a miss.
+        fs::remove(path + ".key", ec);
+        for (const std::string suffix : {".idx", ""})
+        {
+            fs::copy_file(store_path + suffix, path + suffix + ".tmp", fs::copy_options::overwrite_existing, ec);
+            if (!ec)
+                fs::rename(path + suffix + ".tmp", path + suffix, ec);
+            if (ec)
+            {
+                std::cerr << "Failed to add " << store_path << " to the cache: " << ec.message() << std::endl;
+                return false;
+            }
+        }
+        {
+            std::ofstream stored_key(path + ".key.tmp", std::ios::binary | std::ios::trunc);
+            stored_key << key;
+        }
+        fs::rename(path + ".key.tmp", path + ".key", ec);
+        if (ec)
+        {
+            std::cerr << "Failed to add " << store_path << " to the cache: " << ec.message() << std::endl;
+            return false;
+        }
+        evict();
+        return true;
+    }
+
+    void evict() const
+    {
+        namespace fs = std::filesystem;
+        struct Entry
+        {
+            fs::path path;
+            fs::file_time_type used;
+            uintmax_t bytes;
+        };
+
+        std::error_code ec;
+        std::vector<Entry> entries;
+        uintmax_t total = 0;
+        for (const auto &file : fs::directory_iterator(dir, ec))
+        {
+            if (file.path().extension() != ".adelta")
+                continue;
+            uintmax_t bytes = file.file_size(ec) + fs::file_size(file.path().string() + ".idx", ec);
+            entries.push_back({file.path(), file.last_write_time(ec), bytes});
+            total += bytes;
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+                  { return a.used < b.used; });
+        for (const auto &entry : entries)
+        {
+            if (total <= max_bytes)
+                break;
+            fs::remove(entry.path.string() + ".key", ec);
+            fs::remove(entry.path.string() + ".idx", ec);
+            fs::remove(entry.path, ec);
+            total -= entry.bytes;
+        }
+    }
+
+private:
+    std::string dir;
+    uintmax_t max_bytes;
+};
@@ -0,0 +1,338 @@
+#pragma once
+
+// Compact storage for a converted video: a full keyframe every N frames and,
+// in between, the XOR of each grid with the previous one. Consecutive grids are
+// nearly identical, so the XOR is mostly zero bytes and deflates extremely well.
+//
+// Container (<name>.adelta), native little-endian:
+//   header: "ADLT" u32 version, u32 cols, u32 rows, f64 fps, u32 keyframe interval
+//   record: u8 kind (0 key, 1 delta), u32 raw size, u32 compressed size, bytes
+// Index (<name>.adelta.idx): "ADLI", u64 frame count, then one u64 per frame
+// holding the record offset, with the top bit set for keyframes.
+
+#include <zlib.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace delta_store
+{
+    constexpr char container_magic[4] = {'A', 'D', 'L', 'T'};
+    constexpr char index_magic[4] = {'A', 'D', 'L', 'I'};
+    constexpr uint32_t version = 1;
+    constexpr uint64_t keyframe_bit = 1ull << 63;
+    constexpr uint64_t header_size = 4 + 4 + 4 + 4 + 8 + 4;
+    constexpr uint64_t record_header_size = 1 + 4 + 4;
+
+    template <class T>
+    void put(std::ostream &out, T value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <class T>
+    bool get(std::istream &in, T &value)
+    {
+        return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+    }
+}
+
+class DeltaStoreWriter
+{
+public:
+    DeltaStoreWriter(const std::string &path, int cols, int rows, double fps, int keyframe_interval);
+
+    bool ok() const { return static_cast<bool>(out); }
+    bool write(const std::vector<std::string> &grid);
+    // Writes the seek index next to the container.
+    bool finish();
+
+    uint64_t raw_bytes() const { return raw_total; }
+    uint64_t stored_bytes() const { return stored_total; }
+
+private:
+    std::string path;
+    std::ofstream out;
+    int cols;
+    int rows;
+    int keyframe_interval;
+    std::vector<uint64_t> index;
+    std::vector<uint8_t> previous;
+    std::vector<uint8_t> current;
+    std::vector<uint8_t> payload;
+    std::vector<Bytef> compressed;
+    uint64_t raw_total = 0;
+    uint64_t stored_total = 0;
+};
+
+inline DeltaStoreWriter::DeltaStoreWriter(const std::string &path, int cols, int rows, double fps, int keyframe_interval)
+    : path(path), out(path, std::ios::binary | std::ios::trunc), cols(cols), rows(rows),
+      keyframe_interval(keyframe_interval > 0 ? keyframe_interval : 1)
+{
+    // An index left by an earlier run would describe the old container.
+    std::remove((path + ".idx").c_str());
+
+    out.write(delta_store::container_magic, 4);
+    delta_store::put<uint32_t>(out, delta_store::version);
+    delta_store::put<uint32_t>(out, static_cast<uint32_t>(cols));
+    delta_store::put<uint32_t>(out, static_cast<uint32_t>(rows));
+    delta_store::put<double>(out, fps);
+    delta_store::put<uint32_t>(out, static_cast<uint32_t>(this->keyframe_interval));
+
+    const size_t cells = static_cast<size_t>(cols) * rows;
+    previous.assign(cells, ' ');
+    current.assign(cells, ' ');
+    payload.assign(cells, 0);
+    compressed.resize(compressBound(static_cast<uLong>(cells)));
+}
+
+inline bool DeltaStoreWriter::write(const std::vector<std::string> &grid)
+{
+    // Grids are stored at a fixed size; short rows are padded with spaces.
+    for (int j = 0; j < rows; ++j)
+    {
+        uint8_t *row = current.data() + static_cast<size_t>(j) * cols;
+        std::memset(row, ' ', cols);
+        if (j < static_cast<int>(grid.size()))
+            std::memcpy(row, grid[j].data(), std::min<size_t>(grid[j].size(), cols));
+    }
+
+    const bool key = index.size() % keyframe_interval == 0;
+    if (key)
+    {
+        payload = current;
+    }
+    else
+    {
+        for (size_t i = 0; i < current.size(); ++i)
+            payload[i] = current[i] ^ previous[i];
+    }
+
+    uLongf compressed_size = static_cast<uLongf>(compressed.size());
+    if (compress2(compressed.data(), &compressed_size, payload.data(), static_cast<uLong>(payload.size()), Z_BEST_SPEED) != Z_OK)
+    {
+        std::cerr << "Failed to compress frame " << index.size() << std::endl;
+        return false;
+    }
+
+    uint64_t offset = static_cast<uint64_t>(out.tellp());
+    index.push_back(key ? (offset | delta_store::keyframe_bit) : offset);
+
+    delta_store::put<uint8_t>(out, key ? 0 : 1);
+    delta_store::put<uint32_t>(out, static_cast<uint32_t>(payload.size()));
+    delta_store::put<uint32_t>(out, static_cast<uint32_t>(compressed_size));
+    out.write(reinterpret_cast<const char *>(compressed.data()), compressed_size);
+
+    raw_total += current.size() + rows;
+    stored_total += delta_store::record_header_size + compressed_size;
+    previous.swap(current);
+    return static_cast<bool>(out);
+}
+
+inline bool DeltaStoreWriter::finish()
+{
+    out.close();
+    if (out.fail())
+        return false;
+
+    // Written aside and renamed, so a partial index never sits next to the store.
+    const std::string temp_path = path + ".idx.tmp";
+    std::ofstream idx(temp_path, std::ios::binary | std::ios::trunc);
+    idx.write(delta_store::index_magic, 4);
+    delta_store::put<uint64_t>(idx, index.size());
+    idx.write(reinterpret_cast<const char *>(index.data()), index.size() * sizeof(uint64_t));
+    idx.close();
+    if (idx.fail() || std::rename(temp_path.c_str(), (path + ".idx").c_str()) != 0)
+    {
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+class DeltaStoreReader
+{
+public:
+    explicit DeltaStoreReader(const std::string &path);
+
+    bool ok() const { return valid; }
+    int frame_count() const { return static_cast<int>(index.size()); }
+    int width() const { return cols; }
+    int height() const { return rows; }
+    double fps() const { return frames_per_second; }
+
+    // Positions the reader so next() returns `frame`, decoding forward from the
+    // nearest keyframe at or before it.
+    bool seek(int frame);
+    // Decodes the next frame as text, one line per grid row.
+    bool next(std::string &text);
+
+private:
+    bool decode_record();
+    bool load_index(const std::string &path);
+    void rebuild_index();
+
+    std::ifstream in;
+    bool valid = false;
+    int cols = 0;
+    int rows = 0;
+    double frames_per_second = 0;
+    uint32_t keyframe_interval = 0;
+    int position = 0;
+    std::vector<uint64_t> index;
+    std::vector<uint8_t> grid;
+    std::vector<uint8_t> payload;
+    std::vector<Bytef> compressed;
+};
+
+inline DeltaStoreReader::DeltaStoreReader(const std::string &path) : in(path, std::ios::binary)
+{
+    char magic[4];
+    uint32_t file_version = 0;
+    uint32_t header_cols = 0;
+    uint32_t header_rows = 0;
+    if (!in.read(magic, 4) || std::memcmp(magic, delta_store::container_magic, 4) != 0 ||
+        !delta_store::get(in, file_version) || file_version != delta_store::version ||
+        !delta_store::get(in, header_cols) || !delta_store::get(in, header_rows) ||
+        !delta_store::get(in, frames_per_second) || !delta_store::get(in, keyframe_interval))
+    {
+        std::cerr << "Not a delta store: " << path << std::endl;
+        return;
+    }
+    cols = static_cast<int>(header_cols);
+    rows = static_cast<int>(header_rows);
+    grid.assign(static_cast<size_t>(cols) * rows, ' ');
+
+    if (!load_index(path))
+    {
+        index.clear();
+        rebuild_index();
+    }
+
+    valid = true;
+    seek(0);
+}
+
+// Accepts the index file only if it matches the container: its records start
+// right after the header and the last one ends exactly at the end of the file.
+inline bool DeltaStoreReader::load_index(const std::string &path)
+{
+    const std::streampos start = in.tellg();
+    in.seekg(0, std::ios::end);
+    const uint64_t end = static_cast<uint64_t>(in.tellg());
+    in.seekg(start);
+
+    std::ifstream idx(path + ".idx", std::ios::binary);
+    char magic[4];
+    uint64_t count = 0;
+    if (!idx.read(magic, 4) || std::memcmp(magic, delta_store::index_magic, 4) != 0 || !delta_store::get(idx, count) ||
+        count == 0 || count > (end - delta_store::header_size) / delta_store::record_header_size)
+        return false;
+
+    index.resize(count);
+    if (!idx.read(reinterpret_cast<char *>(index.data()), count * sizeof(uint64_t)) ||
+        (index.front() & ~delta_store::keyframe_bit) != delta_store::header_size)
+        return false;
+
+    const uint64_t last = index.back() & ~delta_store::keyframe_bit;
+    uint8_t kind = 0;
+    uint32_t raw_size = 0;
+    uint32_t compressed_size = 0;
+    in.seekg(static_cast<std::streamoff>(last));
+    const bool matches = delta_store::get(in, kind) && delta_store::get(in, raw_size) && delta_store::get(in, compressed_size) &&
+                         last + delta_store::record_header_size + compressed_size == end;
+    in.clear();
+    in.seekg(start);
+    return matches;
+}
+
+// Without a matching index file (e.g. the run was interrupted) the records are
+// scanned once.
+inline void DeltaStoreReader::rebuild_index()
+{
+    std::streampos start = in.tellg();
+    in.seekg(0, std::ios::end);
+    const uint64_t end = static_cast<uint64_t>(in.tellg());
+    in.seekg(start);
+    for (;;)
+    {
+        uint64_t offset = static_cast<uint64_t>(in.tellg());
+        uint8_t kind = 0;
+        uint32_t raw_size = 0;
+        uint32_t compressed_size = 0;
+        if (!delta_store::get(in, kind) || !delta_store::get(in, raw_size) || !delta_store::get(in, compressed_size))
+            break;
+        if (offset + delta_store::record_header_size + compressed_size > end)
+            break;
+        in.seekg(compressed_size, std::ios::cur);
+        index.push_back(kind == 0 ? (offset | delta_store::keyframe_bit) : offset);
+    }
+    in.clear();
+    in.seekg(start);
+}
+
+inline bool DeltaStoreReader::seek(int frame)
+{
+    if (!valid || frame < 0 || frame >= frame_count())
+        return false;
+
+    int key = frame;
+    while (key > 0 && !(index[key] & delta_store::keyframe_bit))
+        --key;
+
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(index[key] & ~delta_store::keyframe_bit));
+    position = key;
+    while (position < frame)
+    {
+        if (!decode_record())
+            return false;
+    }
+    return true;
+}
+
+inline bool DeltaStoreReader::next(std::string &text)
+{
+    if (!valid || position >= frame_count() || !decode_record())
+        return false;
+
+    text.clear();
+    for (int j = 0; j < rows; ++j)
+    {
+        text.append(reinterpret_cast<const char *>(grid.data()) + static_cast<size_t>(j) * cols, cols);
+        text += '\n';
+    }
+    return true;
+}
+
+inline bool DeltaStoreReader::decode_record()
+{
+    uint8_t kind = 0;
+    uint32_t raw_size = 0;
+    uint32_t compressed_size = 0;
+    if (!delta_store::get(in, kind) || !delta_store::get(in, raw_size) || !delta_store::get(in, compressed_size) ||
+        raw_size != grid.size())
+        return false;
+
+    compressed.resize(compressed_size);
+    payload.resize(raw_size);
+    uLongf decoded_size = raw_size;
+    if (!in.read(reinterpret_cast<char *>(compressed.data()), compressed_size) ||
+        uncompress(payload.data(), &decoded_size, compressed.data(), compressed_size) != Z_OK ||
+        decoded_size != raw_size)
+        return false;
+
+    if (kind == 0)
+        grid.swap(payload);
+    else
+        for (size_t i = 0; i < grid.size(); ++i)
+            grid[i] ^= payload[i];
+
+    ++position;
+    return true;
+}
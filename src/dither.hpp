@@ -0,0 +1,251 @@
+#pragma once
+
+// Dithering of the downscaled gray frame to black and white before glyph
+// matching, so gradients come out as glyph density instead of flat bands.
+//
+// Ordered (Bayer) dithering looks at each pixel on its own. Error diffusion
+// carries every pixel's rounding error to neighbours right and below, so it
+// runs as a wavefront over tiles one band of cells high, skewed one pixel left
+// per row: a tile can start once the tile to its left and the one above-right
+// are done, and all tiles on the same anti-diagonal (tx + 2 * ty) can run at
+// the same time.
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class DitherMode
+{
+    none,
+    bayer,
+    floyd_steinberg,
+    atkinson,
+};
+
+// Accepts "bayer", "fs"/"floyd-steinberg" and "atkinson"; false for anything else.
+inline bool parse_dither_mode(const std::string &name, DitherMode &mode)
+{
+    if (name == "none" || name.empty())
+        mode = DitherMode::none;
+    else if (name == "bayer")
+        mode = DitherMode::bayer;
+    else if (name == "fs" || name == "floyd-steinberg")
+        mode = DitherMode::floyd_steinberg;
+    else if (name == "atkinson")
+        mode = DitherMode::atkinson;
+    else
+        return false;
+    return true;
+}
+
+inline const char *dither_mode_name(DitherMode mode)
+{
+    switch (mode)
+    {
+    case DitherMode::bayer:
+        return "bayer";
+    case DitherMode::floyd_steinberg:
+        return "fs";
+    case DitherMode::atkinson:
+        return "atkinson";
+    default:
+        return "none";
+    }
+}
+
+inline bool is_error_diffusion(DitherMode mode)
+{
+    return mode == DitherMode::floyd_steinberg || mode == DitherMode::atkinson;
+}
+
+// Thresholds rows [first_row, first_row + count) against an 8x8 Bayer matrix.
+inline void bayer_dither_rows(cv::Mat &gray, int first_row, int count)
+{
+    static const uint8_t bayer[8][8] = {
+        {0, 32, 8, 40, 2, 34, 10, 42},
+        {48, 16, 56, 24, 50, 18, 58, 26},
+        {12, 44, 4, 36, 14, 46, 6, 38},
+        {60, 28, 52, 20, 62, 30, 54, 22},
+        {3, 35, 11, 43, 1, 33, 9, 41},
+        {51, 19, 59, 27, 49, 17, 57, 25},
+        {15, 47, 7, 39, 13, 45, 5, 37},
+        {63, 31, 55, 23, 61, 29, 53, 21},
+    };
+    for (int y = first_row; y < first_row + count; ++y)
+    {
+        uchar *row = gray.ptr<uchar>(y);
+        const uint8_t *thresholds = bayer[y & 7];
+        for (int x = 0; x < gray.cols; ++x)
+            row[x] = row[x] * 64 > thresholds[x & 7] * 255 + 127 ? 255 : 0;
+    }
+}
+
+// Error diffusion over a tile, in raster order. `carry` holds the error pushed
+// into each pixel so far, in 1/16 units, and must be zeroed for every frame.
+// Tiles run in wavefront order must be one row high: a pixel needs the pixel
+// above-right, which belongs to the next tile, to be finished first.
+inline void diffuse_error_tile(cv::Mat &gray, std::vector<int> &carry, DitherMode mode, cv::Rect tile)
+{
+    const int width = gray.cols;
+    const int height = gray.rows;
+    for (int y = tile.y; y < tile.y + tile.height; ++y)
+    {
+        uchar *row = gray.ptr<uchar>(y);
+        int *error = carry.data() + static_cast<size_t>(y) * width;
+        for (int x = tile.x; x < tile.x + tile.width; ++x)
+        {
+            const int value = row[x] + (error[x] >= 0 ? error[x] + 8 : error[x] - 8) / 16;
+            const int out = value < 128 ? 0 : 255;
+            const int e = value - out;
+            row[x] = static_cast<uchar>(out);
+
+            auto push = [&](int dx, int dy, int weight)
+            {
+                const int nx = x + dx;
+                const int ny = y + dy;
+                if (nx >= 0 && nx < width && ny < height)
+                    carry[static_cast<size_t>(ny) * width + nx] += e * weight;
+            };
+            if (mode == DitherMode::floyd_steinberg)
+            {
+                push(1, 0, 7);
+                push(-1, 1, 3);
+                push(0, 1, 5);
+                push(1, 1, 1);
+            }
+            else
+            {
+                // Atkinson spreads 6/8 of the error, 1/8 to each of six pixels.
+                push(1, 0, 2);
+                push(2, 0, 2);
+                push(-1, 1, 2);
+                push(0, 1, 2);
+                push(1, 1, 2);
+                push(0, 2, 2);
+            }
+        }
+    }
+}
+
+// Error diffusion over a band tile whose rows are shifted one pixel left per
+// row: row `top + r` covers [x0 - r, x1 - r), clipped to the image. Rectangular
+// tiles would need error from the next tile's rows above; skewed ones only
+// need the tile to their left and the band above. Tiles must be at least
+// `height` + 3 pixels wide.
+inline void diffuse_error_skewed_tile(cv::Mat &gray, std::vector<int> &carry, DitherMode mode, int x0, int x1, int top, int height)
+{
+    for (int r = 0; r < height; ++r)
+    {
+        const int first = std::max(0, x0 - r);
+        const int last = std::min(gray.cols, x1 - r);
+        if (first < last)
+            diffuse_error_tile(gray, carry, mode, cv::Rect(first, top + r, last - first, 1));
+    }
+}
+
+// Runs `tile(tx, ty)` for every tile of a cols x rows grid in wavefront order.
+// The calling thread works through ready tiles itself; `enqueue` may hand
+// helper tasks to a thread pool, which join in while tiles remain. Helpers that
+// start after the grid is done return at once, so the caller never waits for a
+// task that has not started.
+//
+// For error diffusion, tiles of one wave touch disjoint error pixels: one
+// pixel row at least 3 pixels wide, or a skewed band as above. Without
+// helpers, tiles simply run in raster order (also a valid wavefront order) and
+// nothing is allocated.
+class Wavefront
+{
+public:
+    static void run(int cols, int rows, size_t helpers, const std::function<void(std::function<void()>)> &enqueue,
+                    const std::function<void(int, int)> &tile)
+    {
+        if (cols <= 0 || rows <= 0)
+            return;
+        if (helpers == 0 || !enqueue)
+        {
+            for (int ty = 0; ty < rows; ++ty)
+                for (int tx = 0; tx < cols; ++tx)
+                    tile(tx, ty);
+            return;
+        }
+        auto state = std::make_shared<State>(cols, rows, tile);
+        for (size_t i = 0; i < helpers && enqueue; ++i)
+            enqueue([state]
+                    { state->work(); });
+        state->work();
+    }
+
+private:
+    struct State
+    {
+        State(int cols, int rows, const std::function<void(int, int)> &tile)
+            : cols(cols), rows(rows), tile(tile), pending(static_cast<size_t>(cols) * rows)
+        {
+            for (int ty = 0; ty < rows; ++ty)
+                for (int tx = 0; tx < cols; ++tx)
+                    pending[ty * cols + tx] = (tx > 0) + (ty > 0);
+            ready.push_back(0);
+        }
+
+        // Returns once every tile is done (or, for a helper, right away if so).
+        void work()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;)
+            {
+                changed.wait(lock, [this]
+                             { return !ready.empty() || finished == cols * rows; });
+                if (finished == cols * rows)
+                    return;
+
+                const int index = ready.front();
+                ready.pop_front();
+                lock.unlock();
+                tile(index % cols, index / cols);
+                lock.lock();
+
+                ++finished;
+                const int tx = index % cols;
+                const int ty = index / cols;
+                int released = release(tx + 1, ty);
+                // The tile below-left waits on this one as its above-right
+                // neighbour; in the last column, the tile below does.
+                if (tx + 1 == cols)
+                    released += release(tx, ty + 1);
+                if (tx > 0)
+                    released += release(tx - 1, ty + 1);
+
+                // This thread takes one of the released tiles itself, so only
+                // the others need a waiter woken for them.
+                if (finished == cols * rows)
+                    changed.notify_all();
+                else
+                    for (int i = 1; i < released; ++i)
+                        changed.notify_one();
+            }
+        }
+
+        int release(int tx, int ty)
+        {
+            if (tx >= cols || ty >= rows || --pending[ty * cols + tx] != 0)
+                return 0;
+            ready.push_back(ty * cols + tx);
+            return 1;
+        }
+
+        int cols;
+        int rows;
+        std::function<void(int, int)> tile;
+        std::vector<int> pending;
+        std::deque<int> ready;
+        int finished = 0;
+        std::mutex mutex;
+        std::condition_variable changed;
+    };
+};
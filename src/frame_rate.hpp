@@ -0,0 +1,106 @@
+#pragma once
+
+// Output frame rate control (--fps). Frames are picked by timestamp, so the
+// output keeps the source timing even when its rate is not a multiple of the
+// target, and callers skip dropped frames with grab() alone: they are never
+// retrieved, color converted or matched.
+
+#include "frame_stream.hpp"
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+class FrameDecimator
+{
+public:
+    FrameDecimator() = default;
+
+    // A target of 0, one at or above the source rate, or a source of unknown
+    // rate keeps every frame.
+    FrameDecimator(double source_fps, double target_fps)
+        : source_fps(source_fps), interval(target_fps > 0 ? 1.0 / target_fps : 0),
+          enabled(source_fps > 0 && target_fps > 0 && target_fps < source_fps)
+    {
+    }
+
+    bool active() const { return enabled; }
+
+    // Rate of the frames that are kept (0 if the source does not say).
+    double output_fps() const
+    {
+        return enabled ? 1.0 / interval : source_fps;
+    }
+
+    // Called once per source frame, in order. `timestamp_ms` is its
+    // presentation time; if the backend does not report one (negative, or not
+    // moving forward) it is derived from the frame index.
+    bool keep(double timestamp_ms)
+    {
+        double t = timestamp_ms / 1000.0;
+        if (!(timestamp_ms >= 0) || (index > 0 && t <= last_time))
+            t = source_fps > 0 ? index / source_fps : 0;
+        ++index;
+        last_time = t;
+        if (!enabled)
+            return true;
+
+        // A frame is kept if it is the closest one to the next output time.
+        const double half_frame = 0.5 / source_fps;
+        if (t + half_frame < next_output)
+            return false;
+        while (next_output <= t + half_frame)
+            next_output += interval;
+        return true;
+    }
+
+private:
+    double source_fps = 0;
+    double interval = 0;
+    bool enabled = false;
+    double next_output = 0;
+    double last_time = 0;
+    long index = 0;
+};
+
+// Moves to the next frame `decimator` keeps, grabbing the ones in between;
+// the caller then fetches it with retrieve().
+inline bool grab_kept(cv::VideoCapture &cap, FrameDecimator &decimator)
+{
+    while (cap.grab())
+    {
+        if (decimator.keep(cap.get(cv::CAP_PROP_POS_MSEC)))
+            return true;
+    }
+    return false;
+}
+
+inline bool read_kept(cv::VideoCapture &cap, cv::Mat &frame, FrameDecimator &decimator)
+{
+    return grab_kept(cap, decimator) && cap.retrieve(frame);
+}
+
+// Piped frames carry no timestamps; they are timed by the stream's rate.
+inline bool read_kept(RawFrameReader &reader, cv::Mat &frame, FrameDecimator &decimator)
+{
+    while (!decimator.keep(-1))
+    {
+        if (!reader.skip())
+            return false;
+    }
+    return reader.read(frame);
+}
+
+// Records the rate of the frames in `dir` for play.sh and video_generator.py,
+// or removes a stale record if the rate is unknown.
+inline void write_frame_rate(const std::string &dir, double fps)
+{
+    const std::string path = dir + "/.fps";
+    if (fps <= 0)
+    {
+        std::remove(path.c_str());
+        return;
+    }
+    std::ofstream out(path, std::ios::trunc);
+    out << fps << '\n';
+}
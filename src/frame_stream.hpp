@@ -0,0 +1,363 @@
+#pragma once
+
+// Frames in and out through pipes instead of files, so the engines can sit
+// between other tools (`ffmpeg ... -f yuv4mpegpipe - | processor --stdin | ...`).
+//
+// Input (--stdin[=FORMAT]) is either a YUV4MPEG2 stream (FORMAT "y4m", the
+// default) or headerless frames: "gray:WxH" (8-bit luma) or "bgr:WxH" (bgr24).
+
+#include <opencv2/opencv.hpp>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+inline bool write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+class RawFrameReader
+{
+public:
+    // `color` asks for bgr24 frames; otherwise gray input stays 8-bit luma
+    // (y4m chroma is skipped) and bgr input is passed through as is.
+    RawFrameReader(int fd, const std::string &format, bool color);
+
+    bool ok() const { return valid; }
+    int width() const { return frame_width; }
+    int height() const { return frame_height; }
+    double fps() const { return frames_per_second; }
+
+    // Same contract as cv::VideoCapture::read; reuses `frame` if it fits.
+    bool read(cv::Mat &frame);
+
+    // Consumes the next frame without converting it.
+    bool skip();
+
+private:
+    bool fill();
+    bool read_exact(void *data, size_t size);
+    bool read_line(std::string &line);
+    bool discard_bytes(size_t size);
+    bool parse_y4m_header();
+
+    enum class Layout
+    {
+        gray,
+        bgr,
+        yuv420,
+        yuv422,
+        yuv444,
+    };
+
+    int fd;
+    bool color;
+    bool valid = false;
+    Layout layout = Layout::gray;
+    bool y4m = false;
+    int frame_width = 0;
+    int frame_height = 0;
+    double frames_per_second = 0;
+    std::vector<char> buffer;
+    size_t buffer_start = 0;
+    size_t buffer_end = 0;
+    std::string line;
+    std::vector<char> discard;
+    cv::Mat planes;
+};
+
+inline RawFrameReader::RawFrameReader(int fd, const std::string &format, bool color)
+    : fd(fd), color(color), buffer(1 << 20)
+{
+    if (format.empty() || format == "y4m")
+    {
+        y4m = true;
+        valid = parse_y4m_header();
+        return;
+    }
+
+    char kind[8] = {};
+    if (std::sscanf(format.c_str(), "%7[a-z]:%dx%d", kind, &frame_width, &frame_height) != 3 ||
+        frame_width <= 0 || frame_height <= 0 || (std::strcmp(kind, "gray") != 0 && std::strcmp(kind, "bgr") != 0))
+    {
+        std::cerr << "Invalid input format '" << format << "', expected y4m, gray:WxH or bgr:WxH." << std::endl;
+        return;
+    }
+    layout = std::strcmp(kind, "gray") == 0 ? Layout::gray : Layout::bgr;
+    valid = true;
+}
+
+inline bool RawFrameReader::parse_y4m_header()
+{
+    if (!read_line(line) || line.rfind("YUV4MPEG2 ", 0) != 0)
+    {
+        std::cerr << "Input is not a YUV4MPEG2 stream." << std::endl;
+        return false;
+    }
+
+    std::string chroma = "420";
+    size_t pos = 0;
+    while ((pos = line.find(' ', pos)) != std::string::npos)
+    {
+        const char tag = line[++pos];
+        const std::string value = line.substr(pos + 1, line.find(' ', pos) - pos - 1);
+        if (tag == 'W')
+            frame_width = std::atoi(value.c_str());
+        else if (tag == 'H')
+            frame_height = std::atoi(value.c_str());
+        else if (tag == 'C')
+            chroma = value;
+        else if (tag == 'F')
+        {
+            int num = 0, den = 0;
+            if (std::sscanf(value.c_str(), "%d:%d", &num, &den) == 2 && den > 0)
+                frames_per_second = static_cast<double>(num) / den;
+        }
+    }
+
+    // Only 8-bit layouts: C420p10 and the like use two bytes per sample.
+    if (chroma == "420" || chroma == "420jpeg" || chroma == "420paldv" || chroma == "420mpeg2")
+        layout = Layout::yuv420;
+    else if (chroma == "422")
+        layout = Layout::yuv422;
+    else if (chroma == "444")
+        layout = Layout::yuv444;
+    else if (chroma == "mono")
+        layout = Layout::gray;
+    else
+    {
+        std::cerr << "Unsupported y4m colorspace C" << chroma << std::endl;
+        return false;
+    }
+
+    if (frame_width <= 0 || frame_height <= 0 || (color && (layout == Layout::yuv422 || layout == Layout::yuv444)))
+    {
+        std::cerr << "Unsupported y4m stream: " << line << std::endl;
+        return false;
+    }
+    return true;
+}
+
+inline bool RawFrameReader::read(cv::Mat &frame)
+{
+    if (!valid)
+        return false;
+    if (y4m && (!read_line(line) || line.rfind("FRAME", 0) != 0))
+        return false;
+
+    const size_t luma_bytes = static_cast<size_t>(frame_width) * frame_height;
+    switch (layout)
+    {
+    case Layout::bgr:
+        frame.create(frame_height, frame_width, CV_8UC3);
+        return read_exact(frame.data, luma_bytes * 3);
+
+    case Layout::yuv420:
+        if (color)
+        {
+            // I420 planes stacked as one (height * 3/2) x width image.
+            planes.create(frame_height * 3 / 2, frame_width, CV_8UC1);
+            if (!read_exact(planes.data, luma_bytes * 3 / 2))
+                return false;
+            cv::cvtColor(planes, frame, cv::COLOR_YUV2BGR_I420);
+            return true;
+        }
+        [[fallthrough]];
+
+    default:
+    {
+        cv::Mat &luma = color ? planes : frame;
+        luma.create(frame_height, frame_width, CV_8UC1);
+        if (!read_exact(luma.data, luma_bytes))
+            return false;
+
+        const size_t chroma_bytes = layout == Layout::yuv420 ? luma_bytes / 2 : layout == Layout::yuv422 ? luma_bytes : layout == Layout::yuv444 ? luma_bytes * 2 : 0;
+        if (!discard_bytes(chroma_bytes))
+            return false;
+
+        if (color)
+            cv::cvtColor(planes, frame, cv::COLOR_GRAY2BGR);
+        return true;
+    }
+    }
+}
+
+inline bool RawFrameReader::skip()
+{
+    if (!valid)
+        return false;
+    if (y4m && (!read_line(line) || line.rfind("FRAME", 0) != 0))
+        return false;
+
+    const size_t luma_bytes = static_cast<size_t>(frame_width) * frame_height;
+    switch (layout)
+    {
+    case Layout::bgr:
+    case Layout::yuv444:
+        return discard_bytes(luma_bytes * 3);
+    case Layout::yuv422:
+        return discard_bytes(luma_bytes * 2);
+    case Layout::yuv420:
+        return discard_bytes(luma_bytes * 3 / 2);
+    default:
+        return discard_bytes(luma_bytes);
+    }
+}
+
+inline bool RawFrameReader::discard_bytes(size_t size)
+{
+    discard.resize(std::min(size, buffer.size()));
+    for (size_t left = size; left > 0; left -= std::min(left, discard.size()))
+    {
+        if (!read_exact(discard.data(), std::min(left, discard.size())))
+            return false;
+    }
+    return true;
+}
+
+inline bool RawFrameReader::fill()
+{
+    buffer_start = 0;
+    buffer_end = 0;
+    for (;;)
+    {
+        ssize_t got = ::read(fd, buffer.data(), buffer.size());
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        buffer_end = static_cast<size_t>(got);
+        return true;
+    }
+}
+
+// Large reads bypass the buffer and land directly in the destination.
+inline bool RawFrameReader::read_exact(void *data, size_t size)
+{
+    char *out = static_cast<char *>(data);
+    const size_t buffered = std::min(size, buffer_end - buffer_start);
+    std::memcpy(out, buffer.data() + buffer_start, buffered);
+    buffer_start += buffered;
+    out += buffered;
+    size -= buffered;
+
+    while (size >= buffer.size())
+    {
+        ssize_t got = ::read(fd, out, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        out += got;
+        size -= static_cast<size_t>(got);
+    }
+    while (size > 0)
+    {
+        if (buffer_start == buffer_end && !fill())
+            return false;
+        const size_t chunk = std::min(size, buffer_end - buffer_start);
+        std::memcpy(out, buffer.data() + buffer_start, chunk);
+        buffer_start += chunk;
+        out += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+inline bool RawFrameReader::read_line(std::string &text)
+{
+    text.clear();
+    for (;;)
+    {
+        if (buffer_start == buffer_end && !fill())
+            return false;
+        const char *begin = buffer.data() + buffer_start;
+        const char *newline = static_cast<const char *>(std::memchr(begin, '\n', buffer_end - buffer_start));
+        if (newline)
+        {
+            text.append(begin, newline);
+            buffer_start += newline - begin + 1;
+            return true;
+        }
+        text.append(begin, buffer_end - buffer_start);
+        buffer_start = buffer_end;
+    }
+}
+
+// Collects frames from any number of threads and writes them to `fd` in index
+// order. Frames that arrive early are copied and held until their turn; once
+// `max_early` are held, the threads delivering later ones wait, so a slow frame
+// stalls its producers instead of growing the backlog. Whatever becomes ready
+// in one call goes out in one write, so a reader downstream (a player on the
+// other end of a pipe) gets every frame as soon as it is in order.
+class OrderedStreamWriter
+{
+public:
+    explicit OrderedStreamWriter(int fd, int first_index = 0, size_t max_early = 16)
+        : fd(fd), next_index(first_index), max_early(std::max<size_t>(1, max_early))
+    {
+    }
+
+    bool write(int index, const char *data, size_t size)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        turn.wait(lock, [&]()
+                  { return index == next_index || early.size() < max_early; });
+        if (index != next_index)
+        {
+            early[index].assign(data, data + size);
+            return !failed;
+        }
+
+        buffer.assign(data, data + size);
+        ++next_index;
+        for (auto it = early.find(next_index); it != early.end(); it = early.find(next_index))
+        {
+            buffer.insert(buffer.end(), it->second.begin(), it->second.end());
+            early.erase(it);
+            ++next_index;
+        }
+        if (!failed)
+            failed = !write_all(fd, buffer.data(), buffer.size());
+        lock.unlock();
+        turn.notify_all();
+        return !failed;
+    }
+
+    // False once a write has failed (e.g. the reader went away).
+    bool ok()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !failed;
+    }
+
+private:
+    int fd;
+    int next_index;
+    size_t max_early;
+    bool failed = false;
+    std::vector<char> buffer;
+    std::map<int, std::vector<char>> early;
+    std::mutex mutex;
+    std::condition_variable turn;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <array>
+#include <cstring>
+#include <map>
+#include <vector>
+
+// All glyphs of one font size packed back to back, already inverted (white text
+// on black) so a frame can be composited with plain row copies.
+struct GlyphAtlas
+{
+    int cell = 0;
+    std::vector<char> chars;
+    std::array<int, 256> index_of{};
+    std::vector<uchar> inverted;
+
+    int blank_index() const
+    {
+        return static_cast<int>(chars.size());
+    }
+
+    const uchar *glyph(int index) const
+    {
+        return inverted.data() + static_cast<size_t>(index) * cell * cell;
+    }
+
+    const uchar *glyph_for(char c) const
+    {
+        return glyph(index_of[static_cast<uchar>(c)]);
+    }
+};
+
+inline GlyphAtlas build_glyph_atlas(const std::map<char, cv::Mat> &font_images, int font_size)
+{
+    GlyphAtlas atlas;
+    atlas.cell = font_size;
+    const size_t glyph_bytes = static_cast<size_t>(font_size) * font_size;
+
+    for (const auto &[char_code, font_image] : font_images)
+    {
+        if (font_image.rows == font_size && font_image.cols == font_size && font_image.type() == CV_8UC1)
+            atlas.chars.push_back(char_code);
+    }
+
+    // One extra all-black glyph at the end for characters the font does not have.
+    atlas.inverted.assign((atlas.chars.size() + 1) * glyph_bytes, 0);
+    atlas.index_of.fill(atlas.blank_index());
+
+    for (size_t g = 0; g < atlas.chars.size(); ++g)
+    {
+        const cv::Mat &font_image = font_images.at(atlas.chars[g]);
+        uchar *dst = atlas.inverted.data() + g * glyph_bytes;
+        for (int y = 0; y < font_size; ++y)
+        {
+            const uchar *src = font_image.ptr<uchar>(y);
+            for (int x = 0; x < font_size; ++x)
+                dst[y * font_size + x] = 255 - src[x];
+        }
+        atlas.index_of[static_cast<uchar>(atlas.chars[g])] = static_cast<int>(g);
+    }
+    return atlas;
+}
+
+// Renders a grid of characters (CV_8UC1, one cell per element) into a grayscale
+// image of `size`. Pixels not covered by a whole cell are left black.
+inline void compose_frame(const cv::Mat &characters_grid, const GlyphAtlas &atlas, cv::Size size, cv::Mat &output)
+{
+    const int cell = atlas.cell;
+    output.create(size, CV_8UC1);
+
+    const int covered_rows = characters_grid.rows * cell;
+    const int covered_cols = characters_grid.cols * cell;
+
+    for (int j = 0; j < characters_grid.rows; ++j)
+    {
+        const char *row_chars = characters_grid.ptr<char>(j);
+        for (int y = 0; y < cell; ++y)
+        {
+            uchar *dst = output.ptr<uchar>(j * cell + y);
+            for (int i = 0; i < characters_grid.cols; ++i)
+                std::memcpy(dst + i * cell, atlas.glyph_for(row_chars[i]) + y * cell, cell);
+            std::memset(dst + covered_cols, 0, size.width - covered_cols);
+        }
+    }
+    for (int y = covered_rows; y < size.height; ++y)
+        std::memset(output.ptr<uchar>(y), 0, size.width);
+}
+
+// Same as compose_frame, but each glyph is tinted with the mean color of the
+// source cell it replaces, so the antialiased glyph edges blend into black.
+inline void compose_frame_color(const cv::Mat &characters_grid, const cv::Mat &source, const GlyphAtlas &atlas, cv::Mat &output)
+{
+    const int cell = atlas.cell;
+    const int cell_area = cell * cell;
+    output.create(source.size(), CV_8UC3);
+    std::memset(output.data, 0, output.step * output.rows);
+
+    for (int j = 0; j < characters_grid.rows; ++j)
+    {
+        const char *row_chars = characters_grid.ptr<char>(j);
+        for (int i = 0; i < characters_grid.cols; ++i)
+        {
+            int sum[3] = {0, 0, 0};
+            for (int y = 0; y < cell; ++y)
+            {
+                const uchar *src = source.ptr<uchar>(j * cell + y) + i * cell * 3;
+                for (int x = 0; x < cell * 3; x += 3)
+                {
+                    sum[0] += src[x];
+                    sum[1] += src[x + 1];
+                    sum[2] += src[x + 2];
+                }
+            }
+            const int color[3] = {sum[0] / cell_area, sum[1] / cell_area, sum[2] / cell_area};
+
+            const uchar *glyph = atlas.glyph_for(row_chars[i]);
+            for (int y = 0; y < cell; ++y)
+            {
+                uchar *dst = output.ptr<uchar>(j * cell + y) + i * cell * 3;
+                const uchar *coverage = glyph + y * cell;
+                for (int x = 0; x < cell; ++x)
+                {
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        int v = coverage[x] * color[c] + 128;
+                        dst[x * 3 + c] = static_cast<uchar>((v + (v >> 8)) >> 8);
+                    }
+                }
+            }
+        }
+    }
+}
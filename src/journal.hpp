@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Append-only record of the frames whose output is complete on disk, so an
+// interrupted conversion can pick up where it stopped.
+//
+// Format: a header line with the run's signature, then "range FIRST LAST" lines
+// (written when the journal is compacted on open) and "frame N" lines appended
+// as workers finish. A torn last line from a crash is simply ignored.
+class FrameJournal
+{
+public:
+    // With `resume`, frames recorded by a previous run with the same signature
+    // are kept if `still_valid(frame)` agrees; otherwise the journal starts empty.
+    FrameJournal(const std::string &path, const std::string &signature, bool resume,
+                 const std::function<bool(int)> &still_valid);
+
+    bool is_done(int frame) const;
+    void mark_done(int frame);
+    size_t done_count() const;
+
+    // Number of frames finished from the start of the video without a gap.
+    int contiguous_prefix() const;
+
+private:
+    std::vector<std::pair<int, int>> ranges() const;
+
+    std::set<int> done;
+    mutable std::mutex mutex;
+    std::ofstream out;
+};
+
+inline FrameJournal::FrameJournal(const std::string &path, const std::string &signature, bool resume,
+                                  const std::function<bool(int)> &still_valid)
+{
+    const std::string header = "ascii-journal 1 " + signature;
+
+    if (resume)
+    {
+        std::ifstream in(path);
+        std::string line;
+        if (std::getline(in, line) && line == header)
+        {
+            while (std::getline(in, line))
+            {
+                std::istringstream fields(line);
+                std::string kind;
+                int first = -1;
+                int last = -1;
+                fields >> kind >> first;
+                if (kind == "range")
+                    fields >> last;
+                else if (kind == "frame")
+                    last = first;
+                if (!fields || first < 0 || last < first)
+                    continue;
+                for (int frame = first; frame <= last; ++frame)
+                    done.insert(frame);
+            }
+        }
+        else if (!line.empty())
+        {
+            std::cerr << "Journal " << path << " belongs to a different job, starting over." << std::endl;
+        }
+
+        for (auto it = done.begin(); it != done.end();)
+            it = still_valid(*it) ? std::next(it) : done.erase(it);
+    }
+
+    // Compact into a side file first so a crash here cannot lose the old journal.
+    const std::string compacted = path + ".tmp";
+    {
+        std::ofstream fresh(compacted, std::ios::trunc);
+        fresh << header << '\n';
+        for (const auto &[first, last] : ranges())
+            fresh << "range " << first << ' ' << last << '\n';
+    }
+    if (std::rename(compacted.c_str(), path.c_str()) == 0)
+        out.open(path, std::ios::app);
+    if (!out.is_open())
+        std::cerr << "Failed to open journal " << path << ", progress will not be resumable." << std::endl;
+}
+
+inline bool FrameJournal::is_done(int frame) const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return done.count(frame) > 0;
+}
+
+inline void FrameJournal::mark_done(int frame)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!done.insert(frame).second)
+        return;
+    if (out.is_open())
+    {
+        out << "frame " << frame << '\n';
+        out.flush();
+    }
+}
+
+inline size_t FrameJournal::done_count() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return done.size();
+}
+
+inline int FrameJournal::contiguous_prefix() const
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    int next = 0;
+    for (auto it = done.begin(); it != done.end() && *it == next; ++it)
+        ++next;
+    return next;
+}
+
+inline std::vector<std::pair<int, int>> FrameJournal::ranges() const
+{
+    std::vector<std::pair<int, int>> result;
+    for (int frame : done)
+    {
+        if (!result.empty() && result.back().second + 1 == frame)
+            result.back().second = frame;
+        else
+            result.push_back({frame, frame});
+    }
+    return result;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+// Area downsampling and grayscale conversion in a single pass. Each source
+// pixel is read once, turned into luma with fixed-point BT.601 weights (the
+// ones cvtColor uses) and summed into the box of the output pixel it falls in.
+// Rows are produced on demand, so a caller can resample one band of cells and
+// match it while those pixels are still in cache.
+//
+// The per-pixel loops are marked `omp simd`; built with -fopenmp-simd (see the
+// Makefile) they vectorize, otherwise they compile as plain loops.
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <vector>
+
+class AreaLumaResampler
+{
+public:
+    // Prepares the box boundaries for a source/target size pair; cheap to call
+    // every frame since nothing is recomputed while the sizes stay the same.
+    void configure(cv::Size source, cv::Size target)
+    {
+        if (source == source_size && target == target_size)
+            return;
+        source_size = source;
+        target_size = target;
+        build_boxes(source.width, target.width, col_start, col_end);
+        build_boxes(source.height, target.height, row_start, row_end);
+        column_sums.assign(source.width, 0);
+    }
+
+    // Writes rows [first_row, first_row + count) of `target` (CV_8UC1, already
+    // sized to the configured target) from `source` (CV_8UC3 BGR or CV_8UC1).
+    void resample_rows(const cv::Mat &source, cv::Mat &target, int first_row, int count)
+    {
+        for (int y = first_row; y < first_row + count; ++y)
+            resample_row(source.ptr<uchar>(0), source.step, source.channels(), y, target.ptr<uchar>(y));
+    }
+
+    // Pointer-level core of resample_rows, for one output row.
+    void resample_row(const uchar *source, size_t source_step, int channels, int y, uchar *out)
+    {
+        const int width = source_size.width;
+        uint32_t *sums = column_sums.data();
+        for (int x = 0; x < width; ++x)
+            sums[x] = 0;
+
+        for (int sy = row_start[y]; sy < row_end[y]; ++sy)
+        {
+            const uchar *src = source + static_cast<size_t>(sy) * source_step;
+            if (channels == 3)
+            {
+#pragma omp simd
+                for (int x = 0; x < width; ++x)
+                    sums[x] += src[3 * x] * blue_weight + src[3 * x + 1] * green_weight + src[3 * x + 2] * red_weight;
+            }
+            else
+            {
+#pragma omp simd
+                for (int x = 0; x < width; ++x)
+                    sums[x] += static_cast<uint32_t>(src[x]) << weight_bits;
+            }
+        }
+
+        const uint64_t box_height = row_end[y] - row_start[y];
+        for (int x = 0; x < target_size.width; ++x)
+        {
+            uint64_t sum = 0;
+            for (int sx = col_start[x]; sx < col_end[x]; ++sx)
+                sum += sums[sx];
+            const uint64_t scale = box_height * (col_end[x] - col_start[x]) << weight_bits;
+            out[x] = static_cast<uchar>((sum + scale / 2) / scale);
+        }
+    }
+
+private:
+    static constexpr int weight_bits = 14;
+    static constexpr uint32_t blue_weight = 1868;
+    static constexpr uint32_t green_weight = 9617;
+    static constexpr uint32_t red_weight = 4899;
+
+    // Output pixel i covers source pixels [start[i], end[i]); when upscaling a
+    // box may be empty, so it is widened to the nearest source pixel.
+    static void build_boxes(int source, int target, std::vector<int> &start, std::vector<int> &end)
+    {
+        start.resize(target);
+        end.resize(target);
+        for (int i = 0; i < target; ++i)
+        {
+            start[i] = static_cast<int>(static_cast<int64_t>(i) * source / target);
+            end[i] = static_cast<int>(static_cast<int64_t>(i + 1) * source / target);
+            if (end[i] <= start[i])
+                end[i] = start[i] + 1;
+        }
+    }
+
+    cv::Size source_size;
+    cv::Size target_size;
+    std::vector<int> col_start;
+    std::vector<int> col_end;
+    std::vector<int> row_start;
+    std::vector<int> row_end;
+    std::vector<uint32_t> column_sums;
+};
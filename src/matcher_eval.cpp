@@ -0,0 +1,261 @@
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <chrono>
+
+#include "cli.hpp"
+#include "glyph_atlas.hpp"
+#include "luma_kernel.hpp"
+#include "matchers.hpp"
+
+// Runs every glyph matcher on a set of clips and reports, for each one, how
+// fast it is and how good the result looks: PSNR and SSIM of the rendered
+// glyphs against the downscaled gray source, and how many cells differ from
+// what the engines' compare_matrices picks.
+//
+// Usage: matcher_eval <font> <font size> <clip>... [--grid=COLSxROWS] [--frames=N] [--csv=FILE]
+
+namespace fs = std::filesystem;
+
+std::map<char, cv::Mat> load_font_images(const std::string &font_dir)
+{
+    std::map<char, cv::Mat> font_images;
+    for (const auto &entry : fs::directory_iterator(font_dir))
+    {
+        if (entry.path().extension() == ".png")
+        {
+            std::string filename = entry.path().stem().string();
+            int char_code;
+            try
+            {
+                char_code = std::stoi(filename);
+            }
+            catch (const std::exception &)
+            {
+                std::cerr << "Invalid glyph file name: " << entry.path() << '\n';
+                continue;
+            }
+            if (char_code < 0 || char_code > 255)
+                continue;
+
+            cv::Mat img = cv::imread(entry.path(), cv::IMREAD_GRAYSCALE);
+            if (!img.empty())
+                font_images[static_cast<char>(char_code)] = img;
+        }
+    }
+    return font_images;
+}
+
+// The reference matcher, as in processor.cpp.
+char compare_matrices(const cv::Mat &segment, const std::map<char, cv::Mat> &font_images)
+{
+    double min_distance = std::numeric_limits<double>::max();
+    char best_match_char = 0;
+
+    for (const auto &[char_code, font_image] : font_images)
+    {
+        if (!segment.empty() && !font_image.empty() && segment.type() == font_image.type() && segment.size() == font_image.size())
+        {
+            cv::bitwise_not(segment, segment); // Not sure why, but this works better
+
+            double distance = cv::norm(segment, font_image, cv::NORM_L2SQR);
+
+            if (distance < min_distance)
+            {
+                min_distance = distance;
+                best_match_char = char_code;
+            }
+        }
+    }
+    return checked_match(best_match_char);
+}
+
+// Mean SSIM over 8x8 windows with a stride of 4, on 8-bit gray images.
+double ssim(const cv::Mat &a, const cv::Mat &b)
+{
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    const int window = 8;
+    const int n = window * window;
+
+    double total = 0;
+    int windows = 0;
+    for (int y = 0; y + window <= a.rows; y += 4)
+    {
+        for (int x = 0; x + window <= a.cols; x += 4)
+        {
+            double sum_a = 0, sum_b = 0, sum_aa = 0, sum_bb = 0, sum_ab = 0;
+            for (int v = 0; v < window; ++v)
+            {
+                const uchar *row_a = a.ptr<uchar>(y + v) + x;
+                const uchar *row_b = b.ptr<uchar>(y + v) + x;
+                for (int u = 0; u < window; ++u)
+                {
+                    sum_a += row_a[u];
+                    sum_b += row_b[u];
+                    sum_aa += row_a[u] * row_a[u];
+                    sum_bb += row_b[u] * row_b[u];
+                    sum_ab += row_a[u] * row_b[u];
+                }
+            }
+            const double mean_a = sum_a / n, mean_b = sum_b / n;
+            const double var_a = sum_aa / n - mean_a * mean_a;
+            const double var_b = sum_bb / n - mean_b * mean_b;
+            const double cov = sum_ab / n - mean_a * mean_b;
+            total += ((2 * mean_a * mean_b + c1) * (2 * cov + c2)) /
+                     ((mean_a * mean_a + mean_b * mean_b + c1) * (var_a + var_b + c2));
+            ++windows;
+        }
+    }
+    return windows > 0 ? total / windows : 1.0;
+}
+
+struct Totals
+{
+    double seconds = 0;
+    double psnr = 0;
+    double ssim = 0;
+    uint64_t cells = 0;
+    uint64_t differing = 0;
+    int frames = 0;
+};
+
+void add_quality(Totals &totals, const cv::Mat &grid, const cv::Mat &reference, const GlyphAtlas &atlas, const cv::Mat &gray, cv::Mat &rendered)
+{
+    compose_frame(grid, atlas, gray.size(), rendered);
+    totals.psnr += std::min(cv::PSNR(gray, rendered), 100.0);
+    totals.ssim += ssim(gray, rendered);
+    totals.frames++;
+    for (int j = 0; j < grid.rows; ++j)
+        for (int i = 0; i < grid.cols; ++i)
+            totals.differing += grid.at<char>(j, i) != reference.at<char>(j, i);
+}
+
+int main(int argc, char *argv[])
+{
+    CliArgs args = parse_cli(argc, argv);
+    if (args.positional.size() < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <font> <font size> <clip>... [--grid=COLSxROWS] [--frames=N] [--csv=FILE]" << std::endl;
+        return 1;
+    }
+
+    const std::string font = args.positional[0];
+    const int font_size = std::atoi(args.positional[1].c_str());
+    int cols = 80;
+    int rows = 24;
+    if (args.has("grid") && (std::sscanf(args.get("grid").c_str(), "%dx%d", &cols, &rows) != 2 || cols <= 0 || rows <= 0))
+    {
+        std::cerr << "Invalid grid '" << args.get("grid") << "', expected COLSxROWS." << std::endl;
+        return 1;
+    }
+    const int max_frames = std::atoi(args.get("frames", "100").c_str());
+
+    auto font_images = load_font_images("fonts/" + font + "_chars");
+    GlyphAtlas atlas = build_glyph_atlas(font_images, font_size);
+    MatchGlyphs glyphs = build_match_glyphs(atlas);
+    if (glyphs.chars.empty())
+    {
+        std::cerr << "No " << font_size << "px glyphs found for font " << font << std::endl;
+        return 1;
+    }
+
+    const std::vector<std::pair<std::string, char (*)(const uchar *, size_t, const MatchGlyphs &)>> variants = {
+        {"exact", match_exact},
+        {"pruned", match_pruned},
+        {"mean", match_mean},
+    };
+
+    Totals reference_totals;
+    std::vector<Totals> totals(variants.size());
+
+    const cv::Size size(cols * font_size, rows * font_size);
+    AreaLumaResampler resampler;
+    cv::Mat frame, gray, scratch, rendered;
+    cv::Mat reference(rows, cols, CV_8UC1);
+    cv::Mat grid(rows, cols, CV_8UC1);
+
+    for (size_t c = 2; c < args.positional.size(); ++c)
+    {
+        std::string clip = args.positional[c];
+        if (!fs::exists(clip))
+            clip = "videos/" + clip + ".mp4";
+        cv::VideoCapture cap(clip);
+        if (!cap.isOpened())
+        {
+            std::cerr << "Error opening video file " << clip << std::endl;
+            continue;
+        }
+
+        int frames = 0;
+        for (; frames < max_frames && cap.read(frame); ++frames)
+        {
+            gray.create(size, CV_8UC1);
+            resampler.configure(frame.size(), size);
+            resampler.resample_rows(frame, gray, 0, size.height);
+
+            // compare_matrices inverts the cell it is given, so it gets a copy.
+            gray.copyTo(scratch);
+            auto start = std::chrono::steady_clock::now();
+            for (int j = 0; j < rows; ++j)
+                for (int i = 0; i < cols; ++i)
+                    reference.at<char>(j, i) = compare_matrices(scratch(cv::Rect(i * font_size, j * font_size, font_size, font_size)), font_images);
+            reference_totals.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            reference_totals.cells += static_cast<uint64_t>(rows) * cols;
+            add_quality(reference_totals, reference, reference, atlas, gray, rendered);
+
+            for (size_t v = 0; v < variants.size(); ++v)
+            {
+                start = std::chrono::steady_clock::now();
+                for (int j = 0; j < rows; ++j)
+                    for (int i = 0; i < cols; ++i)
+                        grid.at<char>(j, i) = variants[v].second(gray.ptr<uchar>(j * font_size) + i * font_size, gray.step, glyphs);
+                totals[v].seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                totals[v].cells += static_cast<uint64_t>(rows) * cols;
+                add_quality(totals[v], grid, reference, atlas, gray, rendered);
+            }
+        }
+        std::cout << "Evaluated " << frames << " frames of " << clip << std::endl;
+    }
+
+    if (reference_totals.frames == 0)
+    {
+        std::cerr << "No frames evaluated." << std::endl;
+        return 1;
+    }
+
+    std::ofstream csv;
+    if (args.has("csv"))
+    {
+        csv.open(args.get("csv"));
+        csv << "matcher,cells_per_second,psnr,ssim,differing_cells_percent\n";
+    }
+
+    std::cout << std::endl
+              << std::left << std::setw(12) << "matcher" << std::right << std::setw(16) << "cells/s" << std::setw(10) << "PSNR"
+              << std::setw(10) << "SSIM" << std::setw(14) << "differ %" << std::endl;
+    auto report = [&](const std::string &name, const Totals &t)
+    {
+        const double cells_per_second = t.seconds > 0 ? t.cells / t.seconds : 0;
+        const double psnr = t.psnr / t.frames;
+        const double mean_ssim = t.ssim / t.frames;
+        const double differing = 100.0 * t.differing / t.cells;
+        std::cout << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(0) << std::setw(16) << cells_per_second
+                  << std::setprecision(2) << std::setw(10) << psnr << std::setprecision(4) << std::setw(10) << mean_ssim
+                  << std::setprecision(3) << std::setw(14) << differing << std::endl;
+        if (csv.is_open())
+            csv << name << ',' << cells_per_second << ',' << psnr << ',' << mean_ssim << ',' << differing << '\n';
+    };
+
+    report("reference", reference_totals);
+    for (size_t v = 0; v < variants.size(); ++v)
+        report(variants[v].first, totals[v]);
+    return 0;
+}
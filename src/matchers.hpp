@@ -0,0 +1,142 @@
+#pragma once
+
+// Glyph matchers that work on raw cell pixels instead of a map of cv::Mats.
+// match_exact and match_pruned pick the same character as compare_matrices;
+// match_mean is a much cheaper approximation. matcher_eval measures each one
+// against compare_matrices.
+
+#include "glyph_atlas.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+// compare_matrices inverts the segment in place before every comparison, so
+// glyph 0 is compared with the inverted cell, glyph 1 with the original one,
+// and so on. Inverting the glyph instead gives the same distance, so each glyph
+// is stored here in the polarity it is effectively matched in.
+struct MatchGlyphs
+{
+    int cell = 0;
+    std::vector<char> chars;
+    std::vector<uchar> pixels;
+    std::vector<int> sums;
+
+    const uchar *glyph(size_t index) const
+    {
+        return pixels.data() + index * cell * cell;
+    }
+};
+
+inline MatchGlyphs build_match_glyphs(const GlyphAtlas &atlas)
+{
+    MatchGlyphs glyphs;
+    glyphs.cell = atlas.cell;
+    glyphs.chars = atlas.chars;
+    const size_t glyph_bytes = static_cast<size_t>(atlas.cell) * atlas.cell;
+    glyphs.pixels.resize(glyphs.chars.size() * glyph_bytes);
+    glyphs.sums.assign(glyphs.chars.size(), 0);
+
+    for (size_t g = 0; g < glyphs.chars.size(); ++g)
+    {
+        const uchar *src = atlas.glyph(static_cast<int>(g));
+        uchar *dst = glyphs.pixels.data() + g * glyph_bytes;
+        for (size_t p = 0; p < glyph_bytes; ++p)
+        {
+            dst[p] = g % 2 == 0 ? src[p] : static_cast<uchar>(255 - src[p]);
+            glyphs.sums[g] += dst[p];
+        }
+    }
+    return glyphs;
+}
+
+// Same fallback as compare_matrices for fonts without a usable match.
+inline char checked_match(char best)
+{
+    const int code = static_cast<uchar>(best);
+    return code == 0 || code > 127 ? '?' : best;
+}
+
+// Exhaustive integer sum of squared differences; ties go to the first glyph.
+inline char match_exact(const uchar *cell, size_t step, const MatchGlyphs &glyphs)
+{
+    const int size = glyphs.cell;
+    uint32_t best_distance = std::numeric_limits<uint32_t>::max();
+    char best = 0;
+    for (size_t g = 0; g < glyphs.chars.size(); ++g)
+    {
+        const uchar *glyph = glyphs.glyph(g);
+        uint32_t distance = 0;
+        for (int y = 0; y < size; ++y)
+        {
+            const uchar *row = cell + y * step;
+            for (int x = 0; x < size; ++x)
+            {
+                int d = row[x] - glyph[y * size + x];
+                distance += d * d;
+            }
+        }
+        if (distance < best_distance)
+        {
+            best_distance = distance;
+            best = glyphs.chars[g];
+        }
+    }
+    return checked_match(best);
+}
+
+// match_exact, but a glyph is abandoned as soon as its partial distance can no
+// longer beat the best one. Distances only grow, so the result is identical.
+inline char match_pruned(const uchar *cell, size_t step, const MatchGlyphs &glyphs)
+{
+    const int size = glyphs.cell;
+    uint32_t best_distance = std::numeric_limits<uint32_t>::max();
+    char best = 0;
+    for (size_t g = 0; g < glyphs.chars.size(); ++g)
+    {
+        const uchar *glyph = glyphs.glyph(g);
+        uint32_t distance = 0;
+        for (int y = 0; y < size && distance < best_distance; ++y)
+        {
+            const uchar *row = cell + y * step;
+            for (int x = 0; x < size; ++x)
+            {
+                int d = row[x] - glyph[y * size + x];
+                distance += d * d;
+            }
+        }
+        if (distance < best_distance)
+        {
+            best_distance = distance;
+            best = glyphs.chars[g];
+        }
+    }
+    return checked_match(best);
+}
+
+// Approximation: the glyph whose overall brightness is closest to the cell's,
+// ignoring its shape.
+inline char match_mean(const uchar *cell, size_t step, const MatchGlyphs &glyphs)
+{
+    const int size = glyphs.cell;
+    int sum = 0;
+    for (int y = 0; y < size; ++y)
+    {
+        const uchar *row = cell + y * step;
+        for (int x = 0; x < size; ++x)
+            sum += row[x];
+    }
+
+    int best_distance = std::numeric_limits<int>::max();
+    char best = 0;
+    for (size_t g = 0; g < glyphs.chars.size(); ++g)
+    {
+        int distance = std::abs(sum - glyphs.sums[g]);
+        if (distance < best_distance)
+        {
+            best_distance = distance;
+            best = glyphs.chars[g];
+        }
+    }
+    return checked_match(best);
+}
@@ -4,6 +4,7 @@
 #include <vector>
 #include <filesystem>
 #include <map>
+#include <set>
 #include <mutex>
 #include <string>
 #include <cmath>
@@ -16,6 +17,22 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <atomic>
+#include <deque>
+#include <csignal>
+
+#include <fcntl.h>
+
+#include "broadcast.hpp"
+#include "buffer_pool.hpp"
+#include "cli.hpp"
+#include "conversion_cache.hpp"
+#include "delta_store.hpp"
+#include "dither.hpp"
+#include "frame_rate.hpp"
+#include "frame_stream.hpp"
+#include "journal.hpp"
+#include "luma_kernel.hpp"
+#include "thread_budget.hpp"
 
 namespace fs = std::filesystem;
 std::mutex io_mutex;
@@ -23,10 +40,13 @@ std::mutex io_mutex;
 class ThreadPool
 {
 public:
-    ThreadPool(size_t threads);
+    // `on_start(i)` runs first on worker i, e.g. to pin it to a CPU.
+    ThreadPool(size_t threads, std::function<void(size_t)> on_start = nullptr);
     ~ThreadPool();
     template <class F>
     void enqueue(F &&f);
+    // Tasks waiting for a free worker.
+    size_t backlog();
 
 private:
     std::vector<std::thread> workers;
@@ -36,11 +56,13 @@ private:
     bool stop;
 };
 
-ThreadPool::ThreadPool(size_t threads) : stop(false)
+ThreadPool::ThreadPool(size_t threads, std::function<void(size_t)> on_start) : stop(false)
 {
     for (size_t i = 0; i < threads; ++i)
-        workers.emplace_back([this]
+        workers.emplace_back([this, i, on_start]
                              {
+            if (on_start)
+                on_start(i);
             for (;;) {
                 std::function<void()> task;
                 {
@@ -66,6 +88,12 @@ ThreadPool::~ThreadPool()
         worker.join();
 }
 
+size_t ThreadPool::backlog()
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    return tasks.size();
+}
+
 template <class F>
 void ThreadPool::enqueue(F &&f)
 {
@@ -76,6 +104,17 @@ void ThreadPool::enqueue(F &&f)
     condition.notify_one();
 }
 
+// Set once in main, before any frame is converted.
+struct DitherSettings
+{
+    DitherMode mode = DitherMode::none;
+    ThreadPool *pool = nullptr;
+    size_t helpers = 0;
+    std::atomic<size_t> frames_in_progress{0};
+};
+
+DitherSettings dither;
+
 std::string formatNumber(int num, int length)
 {
     std::ostringstream oss;
@@ -159,17 +198,29 @@ char compare_matrices(const cv::Mat &segment, const std::map<char, cv::Mat> &fon
     return best_match_char;
 }
 
-std::pair<int, int> get_terminal_size()
+// Current terminal size, without the warnings; false if stdout is not a terminal.
+bool query_terminal_size(int &cols, int &rows)
 {
     struct winsize w;
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0)
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) != 0 || w.ws_col == 0 || w.ws_row == 0)
+        return false;
+    cols = w.ws_col;
+    rows = w.ws_row;
+    return true;
+}
+
+std::pair<int, int> get_terminal_size()
+{
+    int cols = 0;
+    int rows = 0;
+    if (query_terminal_size(cols, rows))
     {
-        if (w.ws_col < 80 || w.ws_row < 20)
+        if (cols < 80 || rows < 20)
         {
-            std::cerr << "\n!!!   Warning: Terminal size (" << w.ws_col << "x" << w.ws_row << ") is too small for optimal display. Consider resizing. !!!" << std::endl;
+            std::cerr << "\n!!!   Warning: Terminal size (" << cols << "x" << rows << ") is too small for optimal display. Consider resizing. !!!" << std::endl;
             std::this_thread::sleep_for(std::chrono::seconds(4));
         }
-        return {w.ws_col, w.ws_row};
+        return {cols, rows};
     }
     else
     {
@@ -178,43 +229,824 @@ std::pair<int, int> get_terminal_size()
     }
 }
 
-void process_frame(const cv::Mat &frame, int count, const std::map<char, cv::Mat> &font_images, int font_size, const std::string &output_txt_dir, const int terminal_height, const int terminal_width)
+// Parses "COLSxROWS", used instead of the local terminal size.
+std::pair<int, int> parse_grid(const std::string &grid)
 {
-    cv::Mat gray_frame;
-    cv::Mat resized_frame;
+    int cols = 0;
+    int rows = 0;
+    if (std::sscanf(grid.c_str(), "%dx%d", &cols, &rows) == 2 && cols > 0 && rows > 0)
+        return {cols, rows};
 
-    cv::resize(frame, resized_frame, cv::Size(terminal_width * font_size, terminal_height * font_size));
-    cvtColor(resized_frame, gray_frame, cv::COLOR_BGR2GRAY);
+    std::cerr << "Invalid grid '" << grid << "', expected COLSxROWS." << std::endl;
+    return get_terminal_size();
+}
+
+// Resampler and gray buffer for one source size and grid size.
+struct SizedScratch
+{
+    cv::Size source;
+    cv::Size target;
+    AreaLumaResampler resampler;
+    cv::Mat gray_frame;
+};
 
+// Buffers each worker thread reuses from frame to frame, so converting and
+// writing a frame does not touch the heap once they have grown to size.
+struct ConversionScratch
+{
+    // Most recently used first. A few sizes are kept so that resizing the
+    // terminal back and forth (--live) does not rebuild them every time.
+    std::vector<SizedScratch> sizes;
     std::vector<std::string> characters_grid;
+    std::vector<int> dither_carry;
+    std::string text;
+    char path[4096];
+};
+
+thread_local ConversionScratch scratch;
+
+const size_t MAX_CACHED_SIZES = 4;
+
+SizedScratch &sized_scratch(cv::Size source, cv::Size target)
+{
+    std::vector<SizedScratch> &sizes = scratch.sizes;
+    for (auto it = sizes.begin(); it != sizes.end(); ++it)
+    {
+        if (it->source == source && it->target == target)
+        {
+            std::rotate(sizes.begin(), it, it + 1);
+            return sizes.front();
+        }
+    }
+
+    if (sizes.size() >= MAX_CACHED_SIZES)
+        sizes.pop_back();
+    sizes.insert(sizes.begin(), SizedScratch{source, target, {}, {}});
+    SizedScratch &entry = sizes.front();
+    entry.resampler.configure(source, target);
+    entry.gray_frame.create(target, CV_8UC1);
+    return entry;
+}
+
+// Minimum width in pixels of an error diffusion tile: wide enough that a
+// 1080p frame still has a few dozen tiles per band to share out.
+const int wavefront_tile_width = 64;
+
+void convert_frame(const cv::Mat &frame, const std::map<char, cv::Mat> &font_images, int font_size, const int terminal_height, const int terminal_width, std::vector<std::string> &characters_grid)
+{
+    SizedScratch &sized = sized_scratch(frame.size(), cv::Size(terminal_width * font_size, terminal_height * font_size));
+    cv::Mat &gray_frame = sized.gray_frame;
+    characters_grid.resize(terminal_height);
+    for (std::string &row_chars : characters_grid)
+        row_chars.resize(terminal_width);
+
+    if (is_error_diffusion(dither.mode))
+    {
+        sized.resampler.resample_rows(frame, gray_frame, 0, gray_frame.rows);
+        std::vector<int> &carry = scratch.dither_carry;
+        carry.assign(gray_frame.total(), 0);
+
+        // Helpers only go to pool threads that would otherwise idle: with a
+        // frame per thread and more queued, the frame runs on its own and
+        // allocates nothing. Frames that do get helpers (--live, the end of a
+        // video) allocate the wavefront state, which the heap allocation
+        // count reports.
+        const size_t busy = dither.frames_in_progress.fetch_add(1) + 1 + dither.pool->backlog();
+        const size_t helpers = busy <= dither.helpers ? dither.helpers + 1 - busy : 0;
+
+        // Tiles are one skewed band of a few cells. Since each row of a tile
+        // starts one pixel further left, a tile completes every cell before
+        // its last one, which the next tile completes; the last tile of a band
+        // runs to the edge of the frame.
+        const int tile_cells = std::max(2, (wavefront_tile_width + font_size - 1) / font_size);
+        const int tiles = (terminal_width + tile_cells - 1) / tile_cells;
+        Wavefront::run(tiles, terminal_height, helpers, [](std::function<void()> task)
+                       { dither.pool->enqueue(std::move(task)); },
+                       [&](int t, int j)
+                       {
+                           const bool last_tile = t + 1 == tiles;
+                           const int x1 = last_tile ? gray_frame.cols + font_size : (t + 1) * tile_cells * font_size;
+                           diffuse_error_skewed_tile(gray_frame, carry, dither.mode, t * tile_cells * font_size, x1, j * font_size, font_size);
+                           const int first = t == 0 ? 0 : t * tile_cells - 1;
+                           const int last = last_tile ? terminal_width : (t + 1) * tile_cells - 1;
+                           for (int i = first; i < last; ++i)
+                               characters_grid[j][i] = compare_matrices(gray_frame(cv::Rect(i * font_size, j * font_size, font_size, font_size)), font_images);
+                       });
+        dither.frames_in_progress.fetch_sub(1);
+        return;
+    }
 
-    for (int j = 0; j <= gray_frame.rows - font_size; j += font_size)
+    // One band of cells at a time: its pixels are still in cache when matched.
+    for (int j = 0; j < terminal_height; ++j)
     {
-        std::string row_chars;
-        for (int i = 0; i <= gray_frame.cols - font_size; i += font_size)
+        sized.resampler.resample_rows(frame, gray_frame, j * font_size, font_size);
+        if (dither.mode == DitherMode::bayer)
+            bayer_dither_rows(gray_frame, j * font_size, font_size);
+
+        std::string &row_chars = characters_grid[j];
+        for (int i = 0; i < terminal_width; ++i)
         {
-            cv::Rect region(i, j, font_size, font_size);
+            cv::Rect region(i * font_size, j * font_size, font_size, font_size);
             cv::Mat segment = gray_frame(region);
 
-            char best_match_char = compare_matrices(segment, font_images);
-            row_chars += best_match_char;
+            row_chars[i] = compare_matrices(segment, font_images);
         }
-        characters_grid.push_back(row_chars);
     }
+}
+
+std::string frame_text_path(const std::string &output_txt_dir, int count)
+{
+    return output_txt_dir + "/frame_" + formatNumber(count, 10) + ".txt";
+}
 
-    std::string text_filename = output_txt_dir + "/frame_" + formatNumber(count, 10) + ".txt";
+bool process_frame(const cv::Mat &frame, int count, const std::map<char, cv::Mat> &font_images, int font_size, const std::string &output_txt_dir, const int terminal_height, const int terminal_width)
+{
+    convert_frame(frame, font_images, font_size, terminal_height, terminal_width, scratch.characters_grid);
 
-    std::ofstream file(text_filename);
-    if (!file)
+    std::string &text = scratch.text;
+    text.clear();
+    for (const auto &row : scratch.characters_grid)
     {
-        std::cerr << "Failed to open text file " << text_filename << std::endl;
-        return;
+        text += row;
+        text += '\n';
+    }
+
+    std::snprintf(scratch.path, sizeof(scratch.path), "%s/frame_%010d.txt", output_txt_dir.c_str(), count);
+    int fd = ::open(scratch.path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open text file " << scratch.path << std::endl;
+        return false;
+    }
+
+    bool written = write_all(fd, text.data(), text.size());
+    return ::close(fd) == 0 && written;
+}
+
+// Identifies a conversion job, so a journal is only resumed by the same job.
+std::string job_signature(const std::string &font, int font_size, const std::string &video_path, int terminal_width, int terminal_height, double target_fps)
+{
+    std::error_code ec;
+    return font + " " + std::to_string(font_size) + " " + video_path + " " +
+           std::to_string(fs::file_size(video_path, ec)) + " " +
+           std::to_string(terminal_width) + "x" + std::to_string(terminal_height) +
+           (dither.mode != DitherMode::none ? std::string(" dither=") + dither_mode_name(dither.mode) : "") +
+           (target_fps > 0 ? " fps=" + std::to_string(target_fps) : "");
+}
+
+// Frames already on disk from an interrupted run are validated by size, which
+// is fixed by the grid, and skipped without being converted again.
+std::unique_ptr<FrameJournal> open_text_journal(const std::string &output_txt_dir, const std::string &signature, bool resume, int terminal_height, int terminal_width)
+{
+    const uintmax_t frame_bytes = static_cast<uintmax_t>(terminal_height) * (terminal_width + 1);
+    return std::make_unique<FrameJournal>(output_txt_dir + "/.journal", signature, resume, [=](int done_frame)
+                                          {
+        std::error_code ec;
+        return fs::file_size(frame_text_path(output_txt_dir, done_frame), ec) == frame_bytes && !ec; });
+}
+
+// Frames being converted on the pool, oldest first. Slots are reused from
+// frame to frame, rows and all, and a task carries only two references, so
+// queuing a frame and collecting its grid does not allocate once every slot
+// has been used.
+class GridQueue
+{
+public:
+    GridQueue(size_t capacity, ThreadPool &pool, FramePool &frames, const std::map<char, cv::Mat> &font_images, int font_size)
+        : slots(capacity), pool(pool), frames(frames), font_images(font_images), font_size(font_size)
+    {
+    }
+
+    // Drains the queue, so no task outlives it.
+    ~GridQueue()
+    {
+        while (!empty())
+            pop();
+    }
+
+    bool empty() const { return count == 0; }
+    bool full() const { return count == slots.size(); }
+
+    // Converts `frame` (a FramePool buffer, released once converted) into a
+    // grid of the given size. Only call while !full().
+    void push(const cv::Mat &frame, int terminal_height, int terminal_width)
+    {
+        Slot &slot = slots[(head + count++) % slots.size()];
+        slot.frame = frame;
+        slot.height = terminal_height;
+        slot.width = terminal_width;
+        slot.ready = false;
+        pool.enqueue([this, &slot]()
+                     { convert(slot); });
+    }
+
+    // Waits for the oldest frame's grid; it stays valid until pop().
+    std::vector<std::string> &front()
+    {
+        Slot &slot = slots[head];
+        std::unique_lock<std::mutex> lock(mutex);
+        converted.wait(lock, [&]()
+                       { return slot.ready; });
+        return slot.grid;
+    }
+
+    void pop()
+    {
+        front();
+        head = (head + 1) % slots.size();
+        --count;
+    }
+
+private:
+    struct Slot
+    {
+        cv::Mat frame;
+        std::vector<std::string> grid;
+        int height = 0;
+        int width = 0;
+        bool ready = false;
+    };
+
+    void convert(Slot &slot)
+    {
+        convert_frame(slot.frame, font_images, font_size, slot.height, slot.width, slot.grid);
+        frames.release(slot.frame);
+        slot.frame.release();
+        std::lock_guard<std::mutex> lock(mutex);
+        slot.ready = true;
+        converted.notify_all();
+    }
+
+    std::vector<Slot> slots;
+    size_t head = 0;
+    size_t count = 0;
+    ThreadPool &pool;
+    FramePool &frames;
+    const std::map<char, cv::Mat> &font_images;
+    int font_size;
+    std::mutex mutex;
+    std::condition_variable converted;
+};
+
+// Decodes on the calling thread, converts on the pool and hands each grid to
+// on_frame(index, grid) in frame order, with at most `window` frames in flight.
+// `cap` is a cv::VideoCapture or a RawFrameReader; frames `decimator` drops are
+// never retrieved. on_frame may swap the grid's contents out, but not keep a
+// reference to it.
+template <class Source, class OnFrame>
+int convert_in_order(Source &cap, FrameDecimator decimator, ThreadPool &pool, size_t window, const std::map<char, cv::Mat> &font_images, int font_size, int terminal_height, int terminal_width, OnFrame on_frame)
+{
+    FramePool frames(window + 1);
+    GridQueue pending(window, pool, frames, font_images, font_size);
+    int count = 0;
+    int delivered = 0;
+
+    for (cv::Mat frame = frames.acquire(); read_kept(cap, frame, decimator); frame = frames.acquire())
+    {
+        if (pending.full())
+        {
+            on_frame(delivered++, pending.front());
+            pending.pop();
+        }
+        pending.push(frame, terminal_height, terminal_width);
+        count++;
+    }
+
+    while (!pending.empty())
+    {
+        on_frame(delivered++, pending.front());
+        pending.pop();
+    }
+    return count;
+}
+
+// Writes each converted frame to stdout as its rows followed by a form feed,
+// in frame order and as soon as it is converted.
+template <class Source>
+int stream_text(Source &source, const FrameDecimator &decimator, ThreadPool &pool, size_t window, const std::map<char, cv::Mat> &font_images, int font_size, int terminal_height, int terminal_width)
+{
+    OrderedStreamWriter out(STDOUT_FILENO);
+    std::string text;
+    return convert_in_order(source, decimator, pool, window, font_images, font_size, terminal_height, terminal_width,
+                            [&](int index, const std::vector<std::string> &grid)
+                            {
+                                text.clear();
+                                for (const std::string &row : grid)
+                                {
+                                    text += row;
+                                    text += '\n';
+                                }
+                                text += '\f';
+                                out.write(index, text.data(), text.size());
+                            });
+}
+
+// Converts the video once and streams it to every connected viewer at the
+// output frame rate. Frames are encoded once, as a keyframe and as a delta.
+int serve_video(cv::VideoCapture &cap, const FrameDecimator &decimator, ThreadPool &pool, size_t window, const std::string &endpoint, bool loop, const std::map<char, cv::Mat> &font_images, int font_size, int terminal_height, int terminal_width)
+{
+    BroadcastServer server(endpoint);
+    if (!server.ok())
+        return -1;
+
+    double fps = decimator.output_fps();
+    auto frame_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(fps > 0 ? 1.0 / fps : 0.04));
+
+    std::cout << "Serving on " << endpoint << " at " << (fps > 0 ? fps : 25) << " fps" << std::endl;
+
+    std::vector<std::string> previous;
+    auto next_frame = std::chrono::steady_clock::now();
+    int total = 0;
+
+    do
+    {
+        total += convert_in_order(cap, decimator, pool, window, font_images, font_size, terminal_height, terminal_width,
+                                  [&](int index, std::vector<std::string> &grid)
+                                  {
+                                      auto full = std::make_shared<const std::string>(encode_full_frame(grid));
+                                      auto delta = previous.empty() ? full : std::make_shared<const std::string>(encode_delta_frame(previous, grid));
+                                      previous.swap(grid);
+
+                                      for (auto now = std::chrono::steady_clock::now(); now < next_frame; now = std::chrono::steady_clock::now())
+                                          server.poll(static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next_frame - now).count()) + 1);
+                                      next_frame = std::max(next_frame + frame_interval, std::chrono::steady_clock::now());
+
+                                      server.publish(full, delta);
+                                      server.poll(0);
+
+                                      if (index % 100 == 0)
+                                      {
+                                          std::lock_guard<std::mutex> guard(io_mutex);
+                                          std::cout << "Streaming frame " << index << " to " << server.client_count() << " viewers" << std::endl;
+                                      }
+                                  });
+    } while (loop && cap.set(cv::CAP_PROP_POS_FRAMES, 0));
+
+    return total;
+}
+
+// Converts the video in order into a keyframe + XOR delta store.
+int store_video(cv::VideoCapture &cap, const FrameDecimator &decimator, ThreadPool &pool, size_t window, const std::string &path, int keyframe_interval, const std::map<char, cv::Mat> &font_images, int font_size, int terminal_height, int terminal_width)
+{
+    DeltaStoreWriter writer(path, terminal_width, terminal_height, decimator.output_fps(), keyframe_interval);
+    if (!writer.ok())
+    {
+        std::cerr << "Failed to create " << path << std::endl;
+        return -1;
+    }
+
+    int count = convert_in_order(cap, decimator, pool, window, font_images, font_size, terminal_height, terminal_width,
+                                 [&](int index, const std::vector<std::string> &grid)
+                                 {
+                                     if (!writer.write(grid))
+                                         std::cerr << "Failed to store frame " << index << std::endl;
+                                     if (index % 100 == 0)
+                                     {
+                                         std::lock_guard<std::mutex> guard(io_mutex);
+                                         std::cout << "Stored frame " << index << std::endl;
+                                     }
+                                 });
+
+    if (!writer.finish())
+        std::cerr << "Failed to write the index of " << path << std::endl;
+    std::cout << "Stored " << count << " frames in " << path << ": " << writer.raw_bytes() << " bytes of text in "
+              << writer.stored_bytes() << " bytes." << std::endl;
+    return count;
+}
+
+// Plays a delta store in the terminal at its recorded frame rate, starting
+// `seek_seconds` in.
+int play_delta_store(const std::string &path, double seek_seconds)
+{
+    DeltaStoreReader reader(path);
+    if (!reader.ok())
+        return 1;
+
+    double fps = reader.fps() > 0 ? reader.fps() : 25;
+    if (!reader.seek(static_cast<int>(seek_seconds * fps)))
+    {
+        std::cerr << "Cannot seek to " << seek_seconds << "s, the video has " << reader.frame_count() << " frames." << std::endl;
+        return 1;
     }
 
-    for (const auto &row : characters_grid)
+    auto frame_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fps));
+    auto next_frame = std::chrono::steady_clock::now();
+    std::string text;
+
+    std::cout << "\x1b[2J";
+    while (reader.next(text))
     {
-        file << row << '\n';
+        std::this_thread::sleep_until(next_frame);
+        next_frame += frame_interval;
+        std::cout << "\x1b[H" << text << std::flush;
     }
+    return 0;
+}
+
+volatile std::sig_atomic_t terminal_resized = 0;
+
+void on_terminal_resize(int)
+{
+    terminal_resized = 1;
+}
+
+// Ctrl-C during --live must not leave the terminal without a cursor: show it
+// again, then die from the signal as usual.
+void on_live_interrupt(int signal_number)
+{
+    static const char show_cursor[] = "\x1b[?25h\n";
+    ssize_t ignored = ::write(STDOUT_FILENO, show_cursor, sizeof(show_cursor) - 1);
+    (void)ignored;
+    std::signal(signal_number, SIG_DFL);
+    std::raise(signal_number);
+}
+
+// Converts and draws straight to the terminal at the output frame rate,
+// following its size: after a SIGWINCH every frame still in flight at the old
+// size is dropped at once and the next decoded frame, converted for the new
+// grid, is drawn as soon as it is ready.
+int play_live(cv::VideoCapture &cap, FrameDecimator decimator, ThreadPool &pool, size_t window, const std::map<char, cv::Mat> &font_images, int font_size)
+{
+    struct sigaction action = {};
+    action.sa_handler = on_terminal_resize;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &action, nullptr);
+
+    struct sigaction interrupt = {};
+    struct sigaction previous_int = {};
+    struct sigaction previous_term = {};
+    interrupt.sa_handler = on_live_interrupt;
+    sigaction(SIGINT, &interrupt, &previous_int);
+    sigaction(SIGTERM, &interrupt, &previous_term);
+
+    int terminal_width = 80;
+    int terminal_height = 24;
+    query_terminal_size(terminal_width, terminal_height);
+
+    double fps = decimator.output_fps();
+    auto frame_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(fps > 0 ? 1.0 / fps : 0.04));
+    auto next_frame = std::chrono::steady_clock::now();
+
+    FramePool frames(window + 1);
+    GridQueue pending(window, pool, frames, font_images, font_size);
+    std::vector<std::string> previous;
+    std::string text;
+    int count = 0;
+
+    auto show = [&](std::vector<std::string> &grid)
+    {
+        std::this_thread::sleep_until(next_frame);
+        text = encode_delta_frame(previous, grid);
+        write_all(STDOUT_FILENO, text.data(), text.size());
+        previous.swap(grid);
+        next_frame = std::max(next_frame + frame_interval, std::chrono::steady_clock::now());
+    };
+
+    std::cout << "\x1b[?25l" << std::flush;
+    for (cv::Mat frame = frames.acquire(); read_kept(cap, frame, decimator); frame = frames.acquire())
+    {
+        if (terminal_resized)
+        {
+            terminal_resized = 0;
+            query_terminal_size(terminal_width, terminal_height);
+
+            // Everything in flight has the old size; waiting for it only
+            // finishes conversions that are already running.
+            while (!pending.empty())
+                pending.pop();
+            next_frame = std::chrono::steady_clock::now();
+        }
+
+        if (pending.full())
+        {
+            show(pending.front());
+            pending.pop();
+        }
+        pending.push(frame, terminal_height, terminal_width);
+        count++;
+    }
+
+    while (!pending.empty())
+    {
+        show(pending.front());
+        pending.pop();
+    }
+    std::cout << "\x1b[?25h\n" << std::flush;
+    sigaction(SIGINT, &previous_int, nullptr);
+    sigaction(SIGTERM, &previous_term, nullptr);
+    return count;
+}
+
+// Bump whenever a change alters the characters produced for a frame, so cached
+// conversions made by an older engine are not reused.
+const std::string ENGINE_VERSION = "2";
+
+// Description of everything that decides the converted result: the video and
+// font contents, the rasterized glyphs (charset and size), the grid, the output
+// frame rate and the engine.
+std::string conversion_cache_key(const std::string &video_path, const std::string &font, const std::string &font_dir, int font_size, int terminal_width, int terminal_height, double target_fps)
+{
+    ContentDigest video_digest;
+    video_digest.update_file(video_path);
+
+    ContentDigest font_digest;
+    font_digest.update_file("fonts/" + font + ".ttf");
+
+    std::vector<fs::path> glyphs;
+    for (const auto &entry : fs::directory_iterator(font_dir))
+    {
+        if (entry.path().extension() == ".png")
+            glyphs.push_back(entry.path());
+    }
+    std::sort(glyphs.begin(), glyphs.end());
+    ContentDigest glyph_digest;
+    for (const auto &glyph : glyphs)
+    {
+        glyph_digest.update(glyph.filename().string());
+        glyph_digest.update_file(glyph);
+    }
+
+    // The cache names the entry after a digest of this and keeps it whole to
+    // compare on lookup.
+    std::string key = "engine " + ENGINE_VERSION + "\nvideo " + video_digest.hex() + "\nfont " + font_digest.hex() +
+                      "\nglyphs " + glyph_digest.hex() + "\nsize " + std::to_string(font_size) +
+                      "\ngrid " + std::to_string(terminal_width) + "x" + std::to_string(terminal_height) + "\n";
+    if (dither.mode != DitherMode::none)
+        key += std::string("dither ") + dither_mode_name(dither.mode) + "\n";
+    if (target_fps > 0)
+        key += "fps " + std::to_string(target_fps) + "\n";
+    return key;
+}
+
+// Produces the requested output straight from a cached delta store: either a
+// copy of the store itself or the usual text frame per file.
+int restore_from_cache(const std::string &entry, bool as_delta, const std::string &delta_path, const std::string &output_txt_dir)
+{
+    DeltaStoreReader reader(entry);
+    if (!reader.ok())
+        return -1;
+
+    if (as_delta)
+    {
+        std::error_code ec;
+        fs::copy_file(entry, delta_path, fs::copy_options::overwrite_existing, ec);
+        if (!ec)
+            fs::copy_file(entry + ".idx", delta_path + ".idx", fs::copy_options::overwrite_existing, ec);
+        return ec ? -1 : reader.frame_count();
+    }
+
+    std::string text;
+    int count = 0;
+    while (reader.next(text))
+    {
+        std::ofstream file(frame_text_path(output_txt_dir, count));
+        if (!file.write(text.data(), text.size()))
+            return -1;
+        count++;
+    }
+    return count;
+}
+
+// Packs the text frames of a finished run into a delta store for the cache.
+bool store_text_frames(const std::string &output_txt_dir, int count, const std::string &path, double fps, int terminal_height, int terminal_width)
+{
+    DeltaStoreWriter writer(path, terminal_width, terminal_height, fps, 250);
+    std::vector<std::string> grid;
+    for (int i = 0; i < count; ++i)
+    {
+        std::ifstream file(frame_text_path(output_txt_dir, i));
+        if (!file)
+            return false;
+        grid.clear();
+        for (std::string row; std::getline(file, row);)
+            grid.push_back(row);
+        if (!writer.write(grid))
+            return false;
+    }
+    return writer.finish();
+}
+
+struct BatchJob
+{
+    std::string name;
+    std::string output_dir;
+    cv::VideoCapture cap;
+    FrameDecimator decimator;
+    std::unique_ptr<FrameJournal> journal;
+    std::unique_ptr<FramePool> frames;
+
+    std::mutex mutex;
+    int next_frame = 0;
+    int in_flight = 0;
+    bool exhausted = false;
+    bool decode_queued = false;
+};
+
+// Lists the videos of a batch: every file in a directory, or one entry per line
+// of a list file. Bare names are looked up in videos/ like the single-video mode.
+std::vector<std::string> list_batch_videos(const std::string &batch)
+{
+    std::vector<std::string> videos;
+    if (fs::is_directory(batch))
+    {
+        for (const auto &entry : fs::directory_iterator(batch))
+        {
+            if (entry.is_regular_file())
+                videos.push_back(entry.path().string());
+        }
+        std::sort(videos.begin(), videos.end());
+        return videos;
+    }
+
+    std::ifstream list(batch);
+    if (!list)
+        std::cerr << "Unable to read batch list " << batch << std::endl;
+    std::string line;
+    while (std::getline(list, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        videos.push_back(fs::exists(line) ? line : "videos/" + line + ".mp4");
+    }
+    return videos;
+}
+
+// Output directory names for a batch: the video's name, prefixed with its
+// parent directory's name when several videos share it, then numbered if that
+// is still not enough.
+std::vector<std::string> batch_output_names(const std::vector<std::string> &videos)
+{
+    std::map<std::string, int> stems;
+    for (const auto &video_path : videos)
+        stems[fs::path(video_path).stem().string()]++;
+
+    std::vector<std::string> names;
+    std::set<std::string> used;
+    for (const auto &video_path : videos)
+    {
+        const fs::path path(video_path);
+        std::string name = path.stem().string();
+        const std::string parent = path.parent_path().filename().string();
+        if (stems[name] > 1 && !parent.empty())
+            name = parent + "_" + name;
+        const std::string base = name;
+        for (int n = 2; used.count(name); ++n)
+            name = base + "-" + std::to_string(n);
+        used.insert(name);
+        names.push_back(name);
+    }
+    return names;
+}
+
+// Converts several videos at once on one pool. Decoding is a pool task too: each
+// job decodes one frame per task and re-queues itself at the back of the FIFO,
+// so jobs take turns and no job holds more than `window` frames in flight. Only
+// about one job per pool thread is open at a time; when one finishes, the next
+// video is opened in its place.
+int run_batch(const std::vector<std::string> &videos, ThreadPool &pool, size_t pool_size, size_t decode_threads, bool resume, double target_fps, AllocationStats &allocation_stats, const std::string &font, const std::map<char, cv::Mat> &font_images, int font_size, int terminal_height, int terminal_width)
+{
+    if (videos.empty())
+        return 0;
+    const std::vector<std::string> names = batch_output_names(videos);
+    std::vector<std::unique_ptr<BatchJob>> jobs(videos.size());
+    const size_t active = std::min(std::max<size_t>(1, pool_size), videos.size());
+
+    // A decode only starts while in_flight < window, so a pool of `window`
+    // buffers per job never blocks a pool thread.
+    const int window = static_cast<int>(std::max<size_t>(2, (2 * pool_size + active - 1) / active));
+    std::atomic<size_t> next_video{0};
+    std::atomic<size_t> finished_jobs{0};
+    std::atomic<int> converted{0};
+
+    std::function<void(BatchJob &)> decode_step;
+    std::function<void(size_t)> start_job;
+
+    // Hands the next video, if any, to a pool thread to open. A job that ends
+    // calls this before it counts as finished, so the batch cannot be seen as
+    // done while a video is still waiting to start.
+    auto start_next = [&]()
+    {
+        const size_t i = next_video.fetch_add(1);
+        if (i < videos.size())
+            pool.enqueue([&start_job, i]()
+                         { start_job(i); });
+    };
+
+    // Called with job.mutex held whenever in_flight drops or a decode finishes.
+    auto schedule = [&](BatchJob &job)
+    {
+        if (job.exhausted)
+        {
+            if (job.in_flight == 0 && !job.decode_queued)
+            {
+                {
+                    std::lock_guard<std::mutex> guard(io_mutex);
+                    std::cout << "Finished " << job.name << " (" << job.next_frame << " frames)" << std::endl;
+                }
+                job.frames.reset();
+                job.journal.reset();
+                start_next();
+                finished_jobs.fetch_add(1, std::memory_order_release);
+            }
+            return;
+        }
+        if (!job.decode_queued && job.in_flight < window)
+        {
+            job.decode_queued = true;
+            pool.enqueue([&decode_step, &job]()
+                         { decode_step(job); });
+        }
+    };
+
+    // decode_queued stays set until the decode is done, so a job never has two
+    // decodes at once and cap, decimator and next_frame need no lock; the job
+    // mutex is only taken to update the shared counters, so conversions that
+    // finish meanwhile are not held up by the decode.
+    decode_step = [&](BatchJob &job)
+    {
+        cv::Mat frame = job.frames->acquire();
+        int next_frame = job.next_frame;
+        int index = -1;
+        while (grab_kept(job.cap, job.decimator))
+        {
+            int candidate = next_frame++;
+            if (job.journal->is_done(candidate))
+                continue;
+            if (job.cap.retrieve(frame))
+                index = candidate;
+            break;
+        }
+        if (index < 0)
+        {
+            job.frames->release(frame);
+            job.cap.release();
+        }
+
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.next_frame = next_frame;
+        job.decode_queued = false;
+        if (index < 0)
+        {
+            job.exhausted = true;
+            schedule(job);
+            return;
+        }
+
+        job.in_flight++;
+        pool.enqueue([&, frame, index]()
+                     {
+            bool ok;
+            {
+                AllocationStats::Scope measure(allocation_stats);
+                ok = process_frame(frame, index, font_images, font_size, job.output_dir, terminal_height, terminal_width);
+            }
+            job.frames->release(frame);
+            if (ok)
+                job.journal->mark_done(index);
+            converted.fetch_add(1, std::memory_order_relaxed);
+
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.in_flight--;
+            schedule(job); });
+        schedule(job);
+    };
+
+    start_job = [&](size_t i)
+    {
+        jobs[i] = std::make_unique<BatchJob>();
+        BatchJob &job = *jobs[i];
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.name = names[i];
+        job.output_dir = "output/" + job.name;
+        if (!open_video(job.cap, videos[i], decode_threads))
+        {
+            std::cerr << "Skipping " << videos[i] << ": unable to open video." << std::endl;
+            start_next();
+            finished_jobs.fetch_add(1, std::memory_order_release);
+            return;
+        }
+        job.decimator = FrameDecimator(job.cap.get(cv::CAP_PROP_FPS), target_fps);
+        fs::create_directories(job.output_dir);
+        write_frame_rate(job.output_dir, job.decimator.output_fps());
+        job.journal = open_text_journal(job.output_dir, job_signature(font, font_size, videos[i], terminal_width, terminal_height, target_fps), resume, terminal_height, terminal_width);
+        job.frames = std::make_unique<FramePool>(window);
+        schedule(job);
+    };
+
+    for (size_t i = 0; i < active; ++i)
+        start_next();
+
+    while (finished_jobs.load(std::memory_order_acquire) < videos.size())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    // The task that finished a job may still be releasing its lock.
+    for (auto &job : jobs)
+        std::lock_guard<std::mutex> lock(job->mutex);
+    return converted.load();
 }
 
 int main(int argc, char *argv[])
@@ -225,14 +1057,23 @@ int main(int argc, char *argv[])
     std::string font;
     int font_size;
 
+    CliArgs args = parse_cli(argc, argv);
+    if (args.has("play"))
+        return play_delta_store(args.get("play"), std::atof(args.get("seek", "0").c_str()));
+
+    // Frames go to stdout, so everything else that would be printed goes to stderr.
+    const bool streaming = args.has("stdin") || args.has("stdout");
+    if (streaming)
+        std::cout.rdbuf(std::cerr.rdbuf());
+
     try
     {
-        if (argc > 1)
-            font = argv[1];
-        if (argc > 2)
-            font_size = std::stoi(argv[2]);
-        if (argc > 3)
-            video = argv[3];
+        if (args.positional.size() > 0)
+            font = args.positional[0];
+        if (args.positional.size() > 1)
+            font_size = std::stoi(args.positional[1]);
+        if (args.positional.size() > 2)
+            video = args.positional[2];
     }
     catch (const std::invalid_argument &ia)
     {
@@ -249,53 +1090,194 @@ int main(int argc, char *argv[])
     std::string output_txt_dir = "output";
     std::string font_dir = "fonts/" + font + "_chars";
 
-    if (!fs::exists(output_txt_dir))
+    if (!streaming && !fs::exists(output_txt_dir))
         fs::create_directories(output_txt_dir);
 
     auto font_images = load_font_images(font_dir);
 
-    cv::VideoCapture cap(video_path);
-    if (!cap.isOpened())
+    // The calling thread decodes; the pool converts (and, in --batch, decodes
+    // too, one frame per task).
+    ThreadBudget budget;
+    if (!parse_thread_budget(args, false, budget))
+        return 1;
+    apply_thread_budget(budget);
+    size_t pool_size = budget.convert;
+    ThreadPool pool(pool_size, [&budget](size_t i)
+                    { pin_to_stage(budget, Stage::convert, i); });
+
+    if (!parse_dither_mode(args.get("dither"), dither.mode))
     {
-        std::cerr << "Error opening video file" << std::endl;
-        return -1;
+        std::cerr << "Unknown dither mode '" << args.get("dither") << "', expected bayer, fs or atkinson." << std::endl;
+        return 1;
     }
+    dither.pool = &pool;
+    dither.helpers = pool_size > 1 ? pool_size - 1 : 0;
 
-    ThreadPool pool(std::thread::hardware_concurrency());
+    const double target_fps = std::atof(args.get("fps", "0").c_str());
+    if (args.has("fps") && !(target_fps > 0))
+    {
+        std::cerr << "Invalid frame rate '" << args.get("fps") << "', expected a positive number." << std::endl;
+        return 1;
+    }
     std::atomic<int> completed_tasks{0};
+    AllocationStats allocation_stats;
 
-    cv::Mat frame;
     int count = 0;
 
-    auto [terminal_width, terminal_height] = get_terminal_size();
+    // --live follows the terminal size on its own, so it skips the size warning.
+    auto [terminal_width, terminal_height] = args.has("grid") ? parse_grid(args.get("grid")) : args.has("live") ? std::make_pair(80, 24) : get_terminal_size();
+
+    std::string delta_path = output_txt_dir + "/" + video + ".adelta";
+    std::unique_ptr<ConversionCache> cache;
+    std::string cache_key;
+    bool cache_hit = false;
 
-    while (cap.read(frame))
+    cv::VideoCapture cap;
+    if (!args.has("batch") && !args.has("stdin") && !open_video(cap, video_path, budget.decode))
     {
-        cv::Mat frame_copy = frame.clone();
-        int current_count = count++;
+        std::cerr << "Error opening video file" << std::endl;
+        return -1;
+    }
+    FrameDecimator decimator(cap.get(cv::CAP_PROP_FPS), target_fps);
+    if (target_fps > 0 && cap.isOpened() && !(cap.get(cv::CAP_PROP_FPS) > 0))
+        std::cerr << "The video does not report its frame rate; --fps is ignored." << std::endl;
 
-        pool.enqueue([=, &completed_tasks]()
-                     {
+    if (args.has("cache") && !args.has("batch") && !args.has("serve") && !args.has("live") && !streaming)
+    {
+        cache = std::make_unique<ConversionCache>(args.get("cache").empty() ? "cache" : args.get("cache"),
+                                                  static_cast<uintmax_t>(std::atoll(args.get("cache-size", "2048").c_str())) << 20);
+        cache_key = conversion_cache_key(video_path, font, font_dir, font_size, terminal_width, terminal_height, target_fps);
+        cache_hit = cache->lookup(cache_key);
+    }
+
+    if (args.has("batch"))
+    {
+        count = run_batch(list_batch_videos(args.get("batch")), pool, pool_size, budget.decode, args.has("resume"), target_fps, allocation_stats, font, font_images, font_size, terminal_height, terminal_width);
+    }
+    else if (args.has("stdin"))
+    {
+        RawFrameReader reader(STDIN_FILENO, args.get("stdin"), false);
+        if (!reader.ok())
+            return -1;
+        if (target_fps > 0 && !(reader.fps() > 0))
+            std::cerr << "The input does not carry a frame rate; --fps is ignored." << std::endl;
+        count = stream_text(reader, FrameDecimator(reader.fps(), target_fps), pool, 2 * pool_size, font_images, font_size, terminal_height, terminal_width);
+    }
+    else if (args.has("stdout"))
+    {
+        count = stream_text(cap, decimator, pool, 2 * pool_size, font_images, font_size, terminal_height, terminal_width);
+    }
+    else if (cache_hit)
+    {
+        count = restore_from_cache(cache->entry_path(cache_key), args.has("delta"), delta_path, output_txt_dir);
+        if (count < 0)
+            return -1;
+        std::cout << "Restored " << count << " frames from the conversion cache." << std::endl;
+        if (!args.has("delta"))
+            write_frame_rate(output_txt_dir, decimator.output_fps());
+    }
+    else if (args.has("delta"))
+    {
+        count = store_video(cap, decimator, pool, 2 * pool_size, delta_path, std::atoi(args.get("keyframe", "250").c_str()), font_images, font_size, terminal_height, terminal_width);
+        if (count < 0)
+            return -1;
+    }
+    else if (args.has("live"))
+    {
+        count = play_live(cap, decimator, pool, 2 * pool_size, font_images, font_size);
+    }
+    else if (args.has("serve"))
+    {
+        count = serve_video(cap, decimator, pool, 2 * pool_size, args.get("serve"), args.has("loop"), font_images, font_size, terminal_height, terminal_width);
+        if (count < 0)
+            return -1;
+    }
+    else
+    {
+        auto journal_ptr = open_text_journal(output_txt_dir, job_signature(font, font_size, video_path, terminal_width, terminal_height, target_fps), args.has("resume"), terminal_height, terminal_width);
+        FrameJournal &journal = *journal_ptr;
+        write_frame_rate(output_txt_dir, decimator.output_fps());
+
+        // With --fps, output frame numbers no longer match source frames, so
+        // the video is not seeked; finished frames are still only grabbed.
+        int resume_from = journal.contiguous_prefix();
+        if (resume_from > 0)
+        {
+            if (!decimator.active() && cap.set(cv::CAP_PROP_POS_FRAMES, resume_from) && static_cast<int>(cap.get(cv::CAP_PROP_POS_FRAMES)) == resume_from)
             {
-                std::lock_guard<std::mutex> guard(io_mutex);
-                std::cout << "Processing frame " << current_count << std::endl;
+                count = resume_from;
+                completed_tasks = resume_from;
             }
-            process_frame(frame_copy, current_count, std::ref(font_images), font_size, output_txt_dir, terminal_height, terminal_width);
-            completed_tasks.fetch_add(1, std::memory_order_relaxed); });
-    }
+            else
+                cap.set(cv::CAP_PROP_POS_FRAMES, 0);
+            std::cout << "Resuming: " << journal.done_count() << " frames already converted." << std::endl;
+        }
 
-    cap.release();
+        FramePool frames(2 * pool_size);
+
+        while (grab_kept(cap, decimator))
+        {
+            int current_count = count++;
+            if (journal.is_done(current_count))
+            {
+                completed_tasks.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            cv::Mat frame = frames.acquire();
+            if (!cap.retrieve(frame))
+            {
+                frames.release(frame);
+                count = current_count;
+                break;
+            }
 
-    while (completed_tasks.load(std::memory_order_relaxed) < count)
+            pool.enqueue([=, &completed_tasks, &journal, &frames, &allocation_stats]()
+                         {
+                {
+                    std::lock_guard<std::mutex> guard(io_mutex);
+                    std::cout << "Processing frame " << current_count << std::endl;
+                }
+                bool written;
+                {
+                    AllocationStats::Scope measure(allocation_stats);
+                    written = process_frame(frame, current_count, std::ref(font_images), font_size, output_txt_dir, terminal_height, terminal_width);
+                }
+                frames.release(frame);
+                if (written)
+                    journal.mark_done(current_count);
+                completed_tasks.fetch_add(1, std::memory_order_release); });
+        }
+
+        while (completed_tasks.load(std::memory_order_acquire) < count)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+
+    if (cache && !cache_hit && count > 0)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        // Text frames are packed into a store first; --delta already made one.
+        std::string staged = output_txt_dir + "/.cache_entry.adelta";
+        if (args.has("delta"))
+            cache->insert(cache_key, delta_path);
+        else if (store_text_frames(output_txt_dir, count, staged, decimator.output_fps(), terminal_height, terminal_width))
+            cache->insert(cache_key, staged);
+        fs::remove(staged);
+        fs::remove(staged + ".idx");
     }
 
+    cap.release();
+
     auto end = std::chrono::high_resolution_clock::now();
     std::cout << "----------------------------------------" << std::endl;
     std::cout << "Video processing completed in C++." << std::endl;
     std::cout << "Processed " << count << " frames in "
               << std::chrono::duration_cast<std::chrono::seconds>(end - start).count()
               << " seconds." << std::endl;
+    if (allocation_stats.frames_measured() > 0)
+        std::cout << "Heap allocations through operator new while converting (after warm-up; OpenCV buffers not counted): "
+                  << allocation_stats.steady_state_allocations() << " over "
+                  << allocation_stats.frames_measured() << " frames." << std::endl;
     return 0;
 }
@@ -0,0 +1,251 @@
+#pragma once
+
+// How many threads each pipeline stage gets, and optionally which CPUs they
+// run on, so several conversions can share a host without oversubscribing it.
+//
+// The default core count is what this process may actually use: the CPUs in
+// its affinity mask (taskset, cpusets), capped by the cgroup CPU quota. With
+// --pin, stages are packed onto those CPUs node by node, so the decoder and
+// the converters reading its frames share a NUMA node whenever they fit on
+// one. Frame buffers are first written by the thread that decodes or renders
+// into them, which places them on that thread's node.
+
+#include "cli.hpp"
+#include <opencv2/opencv.hpp>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class Stage
+{
+    decode,
+    convert,
+    write,
+};
+
+struct ThreadBudget
+{
+    size_t cores = 1;
+    size_t decode = 1;
+    size_t convert = 1;
+    size_t write = 0;
+    bool pin = false;
+    std::vector<int> cpus; // allowed CPUs, node by node
+};
+
+// Parses a cpulist such as "0-15,32-47".
+inline std::vector<int> parse_cpu_list(const std::string &list)
+{
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        int first = 0, last = 0, used = 0;
+        if (std::sscanf(list.c_str() + pos, "%d-%d%n", &first, &last, &used) == 2 ||
+            std::sscanf(list.c_str() + pos, "%d%n", &first, &used) == 1)
+        {
+            if (last < first)
+                last = first;
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+        else
+            break;
+        pos += used;
+        if (pos < list.size() && list[pos] == ',')
+            ++pos;
+    }
+    return cpus;
+}
+
+// CPUs in the affinity mask, grouped by NUMA node.
+inline std::vector<int> allowed_cpus()
+{
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    std::vector<int> cpus;
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0)
+    {
+        for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+            cpus.push_back(static_cast<int>(cpu));
+        return cpus;
+    }
+
+    for (int node = 0;; ++node)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!file || !std::getline(file, list))
+            break;
+        for (int cpu : parse_cpu_list(list))
+        {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &mask))
+            {
+                CPU_CLR(cpu, &mask);
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    // Anything the node files did not list (or no NUMA information at all).
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &mask))
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// Cores allowed by the cgroup CPU quota (v2 cpu.max or v1 cfs_quota_us), or 0
+// if there is none.
+inline size_t cgroup_cpu_limit()
+{
+    std::string group;
+    std::ifstream self("/proc/self/cgroup");
+    for (std::string line; std::getline(self, line);)
+    {
+        if (line.rfind("0::", 0) == 0)
+            group = line.substr(3);
+    }
+
+    double quota = -1, period = 0;
+    for (const std::string &path : {"/sys/fs/cgroup" + group + "/cpu.max", std::string("/sys/fs/cgroup/cpu.max")})
+    {
+        std::ifstream file(path);
+        std::string max;
+        if (file >> max >> period)
+        {
+            quota = max == "max" ? -1 : std::atof(max.c_str());
+            break;
+        }
+    }
+    if (period <= 0)
+    {
+        std::ifstream quota_file("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+        std::ifstream period_file("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+        if (!(quota_file >> quota) || !(period_file >> period))
+            return 0;
+    }
+    return quota > 0 && period > 0 ? static_cast<size_t>(std::ceil(quota / period)) : 0;
+}
+
+inline size_t available_cores(const std::vector<int> &cpus)
+{
+    size_t cores = std::max<size_t>(1, cpus.size());
+    if (size_t limit = cgroup_cpu_limit())
+        cores = std::min(cores, limit);
+    return cores;
+}
+
+inline bool parse_thread_count(const CliArgs &args, const std::string &name, size_t minimum, size_t &value)
+{
+    if (!args.has(name))
+        return true;
+    const std::string text = args.get(name);
+    char *end = nullptr;
+    errno = 0;
+    long count = std::strtol(text.c_str(), &end, 10);
+    if (text.empty() || *end != '\0' || errno != 0 || count < static_cast<long>(minimum))
+    {
+        std::cerr << "Invalid --" << name << " '" << text << "', expected a number of at least " << minimum << "." << std::endl;
+        return false;
+    }
+    value = static_cast<size_t>(count);
+    return true;
+}
+
+// Reads --threads (total cores), --decode-threads, --convert-threads,
+// --write-threads and --pin. Converters get whatever the other stages leave.
+// Engines without a separate write stage pass `has_writers` = false.
+inline bool parse_thread_budget(const CliArgs &args, bool has_writers, ThreadBudget &budget)
+{
+    budget.cpus = allowed_cpus();
+    budget.cores = available_cores(budget.cpus);
+    budget.pin = args.has("pin");
+    if (!parse_thread_count(args, "threads", 1, budget.cores))
+        return false;
+
+    // Pinning to the first `cores` CPUs would put every run sharing this CPU
+    // set on the same ones; only pin when the set is ours alone.
+    if (budget.pin && budget.cores < budget.cpus.size())
+    {
+        std::cerr << "Ignoring --pin: " << budget.cores << " cores budgeted out of " << budget.cpus.size()
+                  << " allowed CPUs. Give each run its own CPUs with taskset or a cpuset to pin." << std::endl;
+        budget.pin = false;
+    }
+
+    budget.decode = std::max<size_t>(1, budget.cores / 8);
+    budget.write = 0;
+    if (!parse_thread_count(args, "decode-threads", 1, budget.decode) ||
+        (has_writers && !parse_thread_count(args, "write-threads", 0, budget.write)))
+        return false;
+
+    const size_t others = budget.decode + budget.write;
+    budget.convert = budget.cores > others ? budget.cores - others : 1;
+    return parse_thread_count(args, "convert-threads", 1, budget.convert);
+}
+
+// Pins the calling thread to its stage's CPUs. The decode stage gets all of
+// its CPUs at once, so the decoder threads it starts inherit them; the other
+// stages get one CPU per thread. Stages wrap around when they need more CPUs
+// than the process is allowed.
+inline void pin_to_stage(const ThreadBudget &budget, Stage stage, size_t index = 0)
+{
+    const size_t usable = budget.cpus.size();
+    if (!budget.pin || usable == 0)
+        return;
+
+    size_t first = index;
+    size_t count = 1;
+    if (stage == Stage::decode)
+    {
+        first = 0;
+        count = std::min(budget.decode, usable);
+    }
+    else if (stage == Stage::convert)
+        first += budget.decode;
+    else
+        first += budget.decode + budget.convert;
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (size_t i = 0; i < count; ++i)
+        CPU_SET(budget.cpus[(first + i) % usable], &mask);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) != 0)
+        std::cerr << "Unable to pin a thread to its CPUs." << std::endl;
+}
+
+// Opens a video whose decoder uses `decode_threads` threads instead of one per
+// core. CAP_PROP_N_THREADS is new in OpenCV 4.7; older versions keep the
+// backend's default.
+inline bool open_video(cv::VideoCapture &cap, const std::string &path, size_t decode_threads)
+{
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 7)
+    return cap.open(path, cv::CAP_ANY, {cv::CAP_PROP_N_THREADS, static_cast<int>(decode_threads)});
+#else
+    (void)decode_threads;
+    return cap.open(path);
+#endif
+}
+
+// Applies the budget to the calling (decoding) thread and to OpenCV, whose own
+// parallel loops are turned off because every stage already runs on its own
+// threads. Must run before the video is opened and the workers are started.
+inline void apply_thread_budget(const ThreadBudget &budget)
+{
+    pin_to_stage(budget, Stage::decode);
+    cv::setNumThreads(1);
+
+    std::cout << "Threads: " << budget.decode << " decode, " << budget.convert << " convert";
+    if (budget.write > 0)
+        std::cout << ", " << budget.write << " write";
+    std::cout << " on " << budget.cores << " cores" << (budget.pin ? " (pinned)" : "") << std::endl;
+}
@@ -23,6 +23,12 @@ def create_video_from_frames(frame_dir, output_video_path, fps=24):
 frame_dir = 'output/frames'
 
 output_video_path = 'output/text.mp4'
+
+# The engine records the rate of the frames it kept (see --fps)
 fps = 24
+fps_path = os.path.join(frame_dir, '.fps')
+if os.path.exists(fps_path):
+    with open(fps_path) as f:
+        fps = float(f.read().strip() or fps)
 
 create_video_from_frames(frame_dir, output_video_path, fps)
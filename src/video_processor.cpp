@@ -1,10 +1,12 @@
 #include <opencv2/opencv.hpp>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <thread>
 #include <filesystem>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <cmath>
@@ -14,6 +16,15 @@
 #include <condition_variable>
 #include <chrono>
 
+#include "buffer_pool.hpp"
+#include "cli.hpp"
+#include "dither.hpp"
+#include "frame_rate.hpp"
+#include "frame_stream.hpp"
+#include "glyph_atlas.hpp"
+#include "journal.hpp"
+#include "thread_budget.hpp"
+
 namespace fs = std::filesystem;
 
 std::mutex io_mutex;
@@ -23,6 +34,17 @@ std::condition_variable condition_var;
 std::queue<std::pair<cv::Mat, int>> frame_queue;
 bool processing_complete = false;
 
+// Rendered frames waiting for PNG encoding, when there are write threads.
+struct PendingWrite
+{
+    cv::Mat image;
+    int count;
+    bool text_written;
+};
+std::condition_variable write_condition;
+std::queue<PendingWrite> write_queue;
+bool rendering_complete = false;
+
 std::string formatNumber(int num, int length)
 {
     std::ostringstream oss;
@@ -74,11 +96,10 @@ std::map<char, cv::Mat> load_font_images(const std::string &font_dir)
     return font_images;
 }
 
-std::pair<char, cv::Mat> compare_matrices(const cv::Mat &segment, const std::map<char, cv::Mat> &font_images)
+char compare_matrices(const cv::Mat &segment, const std::map<char, cv::Mat> &font_images)
 {
     double min_distance = std::numeric_limits<double>::max();
     char best_match_char = '?';
-    cv::Mat best_match_img;
 
     for (const auto &[char_code, font_image] : font_images)
     {
@@ -91,15 +112,40 @@ std::pair<char, cv::Mat> compare_matrices(const cv::Mat &segment, const std::map
             {
                 min_distance = distance;
                 best_match_char = char_code;
-                best_match_img = font_image;
             }
         }
     }
-    return {best_match_char, best_match_img};
+    return best_match_char;
+}
+
+std::string frame_output_path(const std::string &dir, int count, const std::string &extension)
+{
+    return dir + "/frame_" + formatNumber(count, 10) + extension;
+}
+
+// A PNG cut short by a crash is missing its final IEND chunk.
+bool png_is_complete(const std::string &path)
+{
+    static const char iend[8] = {'I', 'E', 'N', 'D', '\xAE', '\x42', '\x60', '\x82'};
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file || file.tellg() < 8)
+        return false;
+    char tail[8];
+    file.seekg(-8, std::ios::end);
+    file.read(tail, 8);
+    return file && std::equal(tail, tail + 8, iend);
 }
 
-void process_frame_worker(const std::map<char, cv::Mat> &font_images, int font_size, const std::string &output_img_dir, const std::string &output_txt_dir)
+// Renders queued frames. With a `stream` the rendered image goes there as raw
+// video; otherwise each frame is saved as PNG plus text and recorded in `journal`.
+// With a `rendered` pool, PNG encoding is left to the write threads.
+void process_frame_worker(const std::map<char, cv::Mat> &font_images, const GlyphAtlas &atlas, int font_size, bool color_output, DitherMode dither, const std::string &output_img_dir, const std::string &output_txt_dir, FrameJournal *journal, OrderedStreamWriter *stream, FramePool &frames, FramePool *rendered, AllocationStats &allocation_stats)
 {
+    cv::Mat gray_frame;
+    cv::Mat characters_grid;
+    cv::Mat own_image;
+    std::vector<int> dither_carry;
+
     while (true)
     {
         std::pair<cv::Mat, int> frame_data;
@@ -116,43 +162,103 @@ void process_frame_worker(const std::map<char, cv::Mat> &font_images, int font_s
 
         cv::Mat frame = frame_data.first;
         int count = frame_data.second;
+        cv::Mat pooled_image = rendered ? rendered->acquire() : cv::Mat();
+        cv::Mat &output_image = rendered ? pooled_image : own_image;
 
-        cv::Mat gray_frame;
-        cvtColor(frame, gray_frame, cv::COLOR_BGR2GRAY);
-
-        cv::Mat output_image = cv::Mat::zeros(gray_frame.size(), gray_frame.type());
-        std::vector<std::string> characters_grid;
-
-        for (int j = 0; j <= gray_frame.rows - font_size; j += font_size)
         {
-            std::string row_chars;
-            for (int i = 0; i <= gray_frame.cols - font_size; i += font_size)
+            AllocationStats::Scope measure(allocation_stats);
+            if (frame.channels() == 1)
+                frame.copyTo(gray_frame);
+            else
+                cvtColor(frame, gray_frame, cv::COLOR_BGR2GRAY);
+
+            // Each worker owns a whole frame, so error diffusion simply runs in
+            // raster order here.
+            if (dither == DitherMode::bayer)
+                bayer_dither_rows(gray_frame, 0, gray_frame.rows);
+            else if (is_error_diffusion(dither))
+            {
+                dither_carry.assign(gray_frame.total(), 0);
+                diffuse_error_tile(gray_frame, dither_carry, dither, cv::Rect(0, 0, gray_frame.cols, gray_frame.rows));
+            }
+
+            characters_grid.create(gray_frame.rows / font_size, gray_frame.cols / font_size, CV_8UC1);
+            for (int j = 0; j < characters_grid.rows; ++j)
             {
-                cv::Rect region(i, j, font_size, font_size);
-                cv::Mat segment = gray_frame(region);
+                char *row_chars = characters_grid.ptr<char>(j);
+                for (int i = 0; i < characters_grid.cols; ++i)
+                {
+                    cv::Rect region(i * font_size, j * font_size, font_size, font_size);
+                    cv::Mat segment = gray_frame(region);
+
+                    row_chars[i] = compare_matrices(segment, font_images);
+                }
+            }
 
-                auto [best_match_char, best_match_img] = compare_matrices(segment, font_images);
-                cv::Mat destination = output_image(cv::Rect(i, j, font_size, font_size));
-                cv::Mat inverted_match_img;
-                cv::bitwise_not(best_match_img, inverted_match_img);
-                inverted_match_img.copyTo(destination);
+            if (color_output)
+                compose_frame_color(characters_grid, frame, atlas, output_image);
+            else
+                compose_frame(characters_grid, atlas, gray_frame.size(), output_image);
+        }
+        if (stream)
+        {
+            // Holding the frame until the writer takes it lets a stalled
+            // stream hold back the decoder too.
+            stream->write(count, reinterpret_cast<const char *>(output_image.data), output_image.total() * output_image.elemSize());
+            frames.release(frame);
+            continue;
+        }
+        frames.release(frame);
 
-                row_chars += best_match_char;
+        std::string text_filename = frame_output_path(output_txt_dir, count, ".txt");
+        std::ofstream file(text_filename);
+        if (file)
+        {
+            for (int j = 0; j < characters_grid.rows; ++j)
+            {
+                file.write(characters_grid.ptr<char>(j), characters_grid.cols);
+                file << '\n';
             }
-            characters_grid.push_back(row_chars);
+            file.close();
         }
 
-        std::string frame_filename = output_img_dir + "/frame_" + formatNumber(count, 10) + ".png";
-        std::string text_filename = output_txt_dir + "/frame_" + formatNumber(count, 10) + ".txt";
+        if (rendered)
+        {
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                write_queue.push({output_image, count, static_cast<bool>(file)});
+            }
+            write_condition.notify_one();
+            continue;
+        }
 
-        cv::imwrite(frame_filename, output_image);
+        bool written = cv::imwrite(frame_output_path(output_img_dir, count, ".png"), output_image);
+        if (written && file)
+            journal->mark_done(count);
+    }
+}
 
-        std::ofstream file(text_filename);
-        if (file)
+// Encodes rendered frames to PNG and hands their buffers back to `rendered`.
+void write_frame_worker(const std::string &output_img_dir, FrameJournal *journal, FramePool &rendered)
+{
+    while (true)
+    {
+        PendingWrite pending;
         {
-            for (const auto &row : characters_grid)
-                file << row << '\n';
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            write_condition.wait(lock, []()
+                                 { return !write_queue.empty() || rendering_complete; });
+            if (write_queue.empty() && rendering_complete)
+                break;
+
+            pending = write_queue.front();
+            write_queue.pop();
         }
+
+        bool written = cv::imwrite(frame_output_path(output_img_dir, pending.count, ".png"), pending.image);
+        rendered.release(pending.image);
+        if (written && pending.text_written)
+            journal->mark_done(pending.count);
     }
 }
 
@@ -164,14 +270,15 @@ int main(int argc, char *argv[])
     std::string font = "ComicMono";
     int font_size = 10;
 
+    CliArgs args = parse_cli(argc, argv);
     try
     {
-        if (argc > 1)
-            font = argv[1];
-        if (argc > 2)
-            font_size = std::stoi(argv[2]);
-        if (argc > 3)
-            video = argv[3];
+        if (args.positional.size() > 0)
+            font = args.positional[0];
+        if (args.positional.size() > 1)
+            font_size = std::stoi(args.positional[1]);
+        if (args.positional.size() > 2)
+            video = args.positional[2];
     }
     catch (const std::invalid_argument &ia)
     {
@@ -189,34 +296,143 @@ int main(int argc, char *argv[])
     std::string output_txt_dir = "output/text";
     std::string font_dir = "fonts/" + font + "_chars";
 
-    if (!fs::exists(output_img_dir))
-        fs::create_directories(output_img_dir);
-    if (!fs::exists(output_txt_dir))
-        fs::create_directories(output_txt_dir);
+    // Rendered frames go to stdout, so everything else printed goes to stderr.
+    const bool streaming = args.has("stdin") || args.has("stdout");
+    if (streaming)
+        std::cout.rdbuf(std::cerr.rdbuf());
 
     auto font_images = load_font_images(font_dir);
+    GlyphAtlas atlas = build_glyph_atlas(font_images, font_size);
+    bool color_output = args.has("color");
+    DitherMode dither = DitherMode::none;
+    if (!parse_dither_mode(args.get("dither"), dither))
+    {
+        std::cerr << "Unknown dither mode '" << args.get("dither") << "', expected bayer, fs or atkinson." << std::endl;
+        return 1;
+    }
+    const double target_fps = std::atof(args.get("fps", "0").c_str());
+    if (args.has("fps") && !(target_fps > 0))
+    {
+        std::cerr << "Invalid frame rate '" << args.get("fps") << "', expected a positive number." << std::endl;
+        return 1;
+    }
+
+    // The calling thread decodes, workers render, and write threads (if any)
+    // encode the PNGs; with --stdout, workers write to the stream themselves.
+    ThreadBudget budget;
+    if (!parse_thread_budget(args, !streaming, budget))
+        return 1;
+    apply_thread_budget(budget);
 
-    cv::VideoCapture cap(video_path);
-    if (!cap.isOpened())
+    std::unique_ptr<RawFrameReader> reader;
+    cv::VideoCapture cap;
+    if (args.has("stdin"))
+    {
+        reader = std::make_unique<RawFrameReader>(STDIN_FILENO, args.get("stdin"), color_output);
+        if (!reader->ok())
+            return -1;
+    }
+    else if (!open_video(cap, video_path, budget.decode))
     {
         std::cerr << "Error opening video file" << std::endl;
         return -1;
     }
+    const double source_fps = reader ? reader->fps() : cap.get(cv::CAP_PROP_FPS);
+    FrameDecimator decimator(source_fps, target_fps);
+    if (target_fps > 0 && !(source_fps > 0))
+        std::cerr << "The input does not report its frame rate; --fps is ignored." << std::endl;
+
+    int count = 0;
+    std::unique_ptr<FrameJournal> journal;
+    std::unique_ptr<OrderedStreamWriter> stream;
+    if (streaming)
+    {
+        int frame_width = reader ? reader->width() : static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
+        int frame_height = reader ? reader->height() : static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
+        std::cerr << "Writing rawvideo " << (color_output ? "bgr24 " : "gray ") << frame_width << "x" << frame_height;
+        if (decimator.output_fps() > 0)
+            std::cerr << " at " << decimator.output_fps() << " fps";
+        std::cerr << " to stdout." << std::endl;
+        stream = std::make_unique<OrderedStreamWriter>(STDOUT_FILENO, 0, budget.convert);
+    }
+    else
+    {
+        if (!fs::exists(output_img_dir))
+            fs::create_directories(output_img_dir);
+        if (!fs::exists(output_txt_dir))
+            fs::create_directories(output_txt_dir);
+
+        // Outputs of an interrupted run are kept if both files are complete; the text
+        // size is fixed by the frame dimensions, which are part of the signature.
+        int frame_width = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
+        int frame_height = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
+        const uintmax_t text_bytes = static_cast<uintmax_t>(frame_height / font_size) * (frame_width / font_size + 1);
+        std::string signature = font + " " + std::to_string(font_size) + " " + video + " " +
+                                std::to_string(fs::file_size(video_path)) + " " +
+                                std::to_string(frame_width) + "x" + std::to_string(frame_height) +
+                                (color_output ? " color" : " gray") +
+                                (dither != DitherMode::none ? std::string(" dither=") + dither_mode_name(dither) : "") +
+                                (target_fps > 0 ? " fps=" + std::to_string(target_fps) : "");
+        journal = std::make_unique<FrameJournal>("output/.journal", signature, args.has("resume"), [=](int done_frame)
+                                                 {
+            std::error_code ec;
+            return fs::file_size(frame_output_path(output_txt_dir, done_frame, ".txt"), ec) == text_bytes && !ec &&
+                   png_is_complete(frame_output_path(output_img_dir, done_frame, ".png")); });
+
+        write_frame_rate(output_img_dir, decimator.output_fps());
+
+        // Output frame numbers only match source frames without --fps.
+        int resume_from = journal->contiguous_prefix();
+        if (resume_from > 0)
+        {
+            if (!decimator.active() && cap.set(cv::CAP_PROP_POS_FRAMES, resume_from) && static_cast<int>(cap.get(cv::CAP_PROP_POS_FRAMES)) == resume_from)
+                count = resume_from;
+            else
+                cap.set(cv::CAP_PROP_POS_FRAMES, 0);
+            std::cout << "Resuming: " << journal->done_count() << " frames already converted." << std::endl;
+        }
+    }
 
-    int num_threads = std::thread::hardware_concurrency();
+    int num_threads = static_cast<int>(budget.convert);
+    FramePool frames(2 * num_threads);
+    std::unique_ptr<FramePool> rendered;
+    if (budget.write > 0)
+        rendered = std::make_unique<FramePool>(budget.convert + 2 * budget.write);
+    AllocationStats allocation_stats;
     std::vector<std::thread> threads;
     for (int i = 0; i < num_threads; ++i)
     {
-        threads.emplace_back(process_frame_worker, std::ref(font_images), font_size, output_img_dir, output_txt_dir);
+        threads.emplace_back([&, i]()
+                             {
+            pin_to_stage(budget, Stage::convert, i);
+            process_frame_worker(font_images, atlas, font_size, color_output, dither, output_img_dir, output_txt_dir, journal.get(), stream.get(), frames, rendered.get(), allocation_stats); });
+    }
+    std::vector<std::thread> writers;
+    for (size_t i = 0; i < budget.write; ++i)
+    {
+        writers.emplace_back([&, i]()
+                             {
+            pin_to_stage(budget, Stage::write, i);
+            write_frame_worker(output_img_dir, journal.get(), *rendered); });
     }
 
-    cv::Mat frame;
-    int count = 0;
-    while (cap.read(frame))
+    while (reader || grab_kept(cap, decimator))
     {
+        if (journal && journal->is_done(count))
+        {
+            count++;
+            continue;
+        }
+        cv::Mat frame = frames.acquire();
+        if (!(reader ? read_kept(*reader, frame, decimator) : cap.retrieve(frame)))
+        {
+            frames.release(frame);
+            break;
+        }
+
         {
             std::unique_lock<std::mutex> lock(queue_mutex);
-            frame_queue.push({frame.clone(), count});
+            frame_queue.push({frame, count});
         }
         condition_var.notify_one();
         std::cout << "Processed frame " << count << std::endl;
@@ -236,6 +452,16 @@ int main(int argc, char *argv[])
             th.join();
     }
 
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        rendering_complete = true;
+    }
+    write_condition.notify_all();
+    for (auto &th : writers)
+        th.join();
+    if (stream && !stream->ok())
+        std::cerr << "Failed to write to stdout" << std::endl;
+
     cap.release();
 
     auto end = std::chrono::high_resolution_clock::now();
@@ -243,6 +469,7 @@ int main(int argc, char *argv[])
     std::cout << "----------------------------------------" << std::endl;
     std::cout << "Video processing completed in C++." << std::endl;
     std::cout << "Processed " << count << " frames in " << std::chrono::duration_cast<std::chrono::seconds>(end - start).count() << " seconds." << std::endl;
+    std::cout << "Heap allocations through operator new while converting (after warm-up; OpenCV buffers not counted): " << allocation_stats.steady_state_allocations() << " over " << allocation_stats.frames_measured() << " frames." << std::endl;
 
     return 0;
 }